@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+
+/*
+ * Productores concurrentes sobre /proc/modlist. Compilar con:
+ *  gcc -Wall -O2 -pthread -o add_bench add_bench.c
+ *  ./add_bench [productores] [segundos]
+ * Cada productor se fija a una CPU distinta y hace un write() por cada
+ * "add N", como un echo add N > /proc/modlist sin el coste de abrir el fichero.
+ * Muestra los add por segundo de todos los productores juntos y el total de
+ * add hechos (bench_add.sh lo compara con nr_items del modulo).
+ */
+
+const char *file = "/proc/modlist";
+
+static volatile int stop = 0;
+
+struct producer {
+	pthread_t thread;
+	int cpu;
+	unsigned long adds;
+};
+
+static void *producer(void *arg){
+	struct producer *p = arg;
+	cpu_set_t set;
+	char cmd[32];
+	int fd, len;
+
+	CPU_ZERO(&set);
+	CPU_SET(p->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	fd = open(file, O_WRONLY);
+	if (fd < 0){
+		perror(file);
+		return NULL;
+	}
+	while (!stop){
+		/* modlist parsea con kstrtoint: un valor fuera de int se rechaza sin error en write() */
+		len = sprintf(cmd, "add %lu\n", (p->cpu * 1000000UL + p->adds) % INT_MAX);
+		if (write(fd, cmd, len) != len){
+			perror("write");
+			break;
+		}
+		p->adds++;
+	}
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char *argv[]){
+	int nprod = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct producer *prods;
+	unsigned long total = 0;
+	int i, secs;
+
+	secs = argc > 2 ? atoi(argv[2]) : 5;
+	if (nprod <= 0 || secs <= 0){
+		printf("Usage: %s [producers] [seconds]\n", argv[0]);
+		return -1;
+	}
+	prods = calloc(nprod, sizeof(struct producer));
+	if (!prods){
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < nprod; i++){
+		prods[i].cpu = i % ncpus;
+		pthread_create(&prods[i].thread, NULL, producer, &prods[i]);
+	}
+	sleep(secs);
+	stop = 1;
+	for (i = 0; i < nprod; i++){
+		pthread_join(prods[i].thread, NULL);
+		total += prods[i].adds;
+	}
+
+	printf("%d productores, %d s: %.0f add/s, %lu add\n", nprod, secs, (double)total / secs, total);
+	free(prods);
+	return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Uso: sudo ./bench_add.sh [segundos]
+# Mide los add/s de 1, 2, 4... productores (hasta el numero de CPUs) con el
+# modulo cargado en modo list (un solo mtx) y en modo sharded (una lista por
+# CPU). Necesita modlist.ko compilado y add_bench (ver add_bench.c). Tras
+# cada ejecucion comprueba que nr_items coincide con los add que add_bench
+# dice haber hecho: un add rechazado por el modulo inflaria los add/s.
+
+SECS=${1:-5}
+CPUS=$(nproc)
+NR_ITEMS=/sys/module/modlist/parameters/nr_items
+
+run() {
+	OUT=$(./add_bench $1 $SECS) || exit 1
+	echo "$OUT"
+	ADDS=$(echo "$OUT" | awk '{ print $(NF-1) }')
+	ITEMS=$(cat $NR_ITEMS)
+	if [ "$ADDS" != "$ITEMS" ]; then
+		echo "FALLO: add_bench cuenta $ADDS add pero la lista tiene $ITEMS elementos"
+		rmmod modlist
+		exit 1
+	fi
+	echo cleanup > /proc/modlist
+}
+
+for MODE in list sharded; do
+	rmmod modlist 2>/dev/null
+	insmod modlist.ko mode=$MODE || exit 1
+	echo "modo $MODE"
+	for ((P=1; $P<$CPUS; P=2*$P)); do
+		run $P
+	done
+	run $CPUS
+done
+rmmod modlist
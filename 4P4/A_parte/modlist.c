@@ -2,182 +2,1349 @@
 #include <linux/module.h>
 #include <linux/proc_fs.h>
 #include <linux/string.h>
+#include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/uaccess.h>
 #include <linux/ftrace.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/hashtable.h>
+#include <linux/rbtree.h>
+#include <linux/moduleparam.h>
+#include <linux/ratelimit.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/compat.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
 #include <asm/spinlock.h>
 
+#include "modlist_ioctl.h"
+
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Modlist Kernel Module - FDI-UCM");
 MODULE_AUTHOR("Xukai Chen, Daniel Alfaro");
 
-#define MAX_SIZE      		12
-#define TEMP_BUFFER_LENGTH  4
-#define COMMANDS_LENGTH		100	
+#define COMMANDS_LENGTH		100		// longitud maxima de una linea de comando
+#define BATCH_LENGTH		PAGE_SIZE	// texto copiado del usuario de cada vez, con el '\0'
+#define MAX_BATCH_CMDS		(PAGE_SIZE / sizeof(struct modlist_cmd))	// comandos por cada toma de mtx
+#define MIN_COMMAND_LENGTH	6		// "add 1\n": un write de len bytes trae como mucho len / 6 + 1 comandos
+#define HASH_BITS_MODLIST	16		// 64K cubetas para el indice de remove
+#define SHARD_HASH_BITS		10		// 1K cubetas en cada sublista del modo sharded
 
 static struct proc_dir_entry *proc_entry;
 struct list_head mylist; // nodo fantasma
 
 struct list_item {
 	int data;
-	struct list_head links;
+	int cursor;		// 1 si es el marcador de un lector, no un dato
+	union {
+		struct {	// modo list
+			struct list_head links;	// orden de insercion (lo que se ve en cat)
+			union {
+				struct hlist_node hash;	// indice por valor para remove (solo escritores)
+				struct rcu_head rcu;	// liberacion diferida una vez fuera de la lista
+			};
+		};
+		struct {	// modo sorted
+			struct rb_node node;
+			u64 seq;
+		};
+	};
+};
+
+/*
+ * list: orden de insercion con duplicados; sorted: multiconjunto ordenado;
+ * sharded: una lista por CPU, para muchos productores a la vez
+ */
+static char *mode = "list";
+static bool sorted_mode = false;
+static bool sharded_mode = false;
+
+module_param(mode, charp, 0444);
+MODULE_PARM_DESC(mode, "Storage mode: list (insertion order, default), sorted (rbtree) or sharded (per-CPU lists)");
+
+/* Cache propia para los nodos: 40 bytes por dato en vez de una pagina de vmalloc */
+static struct kmem_cache *item_cache;
+static unsigned int nr_items = 0;	// datos enlazados en mylist (protegido por mtx)
+
+/* Indice hash por valor: remove solo recorre los elementos de su cubeta */
+static DEFINE_HASHTABLE(modlist_hash, HASH_BITS_MODLIST);
+
+/*
+ * Modo sharded: cada CPU añade a su propia sublista, con su propio cerrojo e
+ * indice, asi los productores de distintas CPUs no se pelean por mtx. remove,
+ * cleanup y las lecturas visitan todas las sublistas (cat las muestra una
+ * detras de otra, cada una en orden de insercion).
+ */
+struct modlist_shard {
+	spinlock_t lock;
+	struct list_head list;
+	DECLARE_HASHTABLE(hash, SHARD_HASH_BITS);
+	unsigned int nr_items;		// protegidos por lock
+	unsigned int nr_commands;
+};
+
+static struct modlist_shard __percpu *shards = NULL;
+
+/* En modo sharded los contadores estan repartidos por CPU y se suman al leerlos */
+static unsigned int modlist_total(unsigned int *counter){
+	struct modlist_shard *shard;
+	unsigned int total = READ_ONCE(*counter);
+	int cpu;
+
+	if (!shards)
+		return total;
+	for_each_possible_cpu(cpu){
+		shard = per_cpu_ptr(shards, cpu);
+		if (counter == &nr_items)
+			total += READ_ONCE(shard->nr_items);
+		else
+			total += READ_ONCE(shard->nr_commands);
+	}
+	return total;
+}
+
+static int modlist_counter_get(char *buffer, const struct kernel_param *kp){
+	struct kernel_param sum = *kp;
+	unsigned int total = modlist_total(kp->arg);
+
+	sum.arg = &total;
+	return param_get_uint(buffer, &sum);
+}
+
+static const struct kernel_param_ops modlist_counter_ops = {
+	.set = param_set_uint,
+	.get = modlist_counter_get,
+};
+
+module_param_cb(nr_items, &modlist_counter_ops, &nr_items, 0444);
+MODULE_PARM_DESC(nr_items, "Items currently in the list (objects of the modlist_item cache)");
+
+/* Estado de lectura de cada apertura de /proc/modlist */
+struct modlist_iter {
+	struct list_item *cursor;	// marcador que se deja en mylist en cada stop()
+	struct list_item *spare;	// marcador reservado para el siguiente stop()
+	int cursor_shard;			// modo sharded: sublista del marcador
+	int shard;					// modo sharded: sublista del ultimo elemento devuelto
+	loff_t cursor_pos;			// posicion del elemento que sigue al marcador
+	loff_t pos;					// posicion del ultimo elemento devuelto por start/next
+	int lo, hi;					// rango de valores a mostrar (comando range)
+	int next_data;				// modo sorted: clave desde la que continuar
+	u64 next_seq;
 };
 
+/*
+ * mtx solo serializa a los escritores (y la recolocacion de marcadores). Los
+ * lectores recorren mylist con RCU y los nodos sacados de la lista se liberan
+ * tras un periodo de gracia. En modo sharded el cerrojo de cada sublista hace
+ * el papel de mtx.
+ */
 // Commit P4
 static spinlock_t mtx;
 
+/*
+ * Tiempos de los cerrojos de escritura (espera y retencion), solo mientras
+ * corre un benchmark de debugfs: fuera de el la clave estatica deja
+ * bench_spin_lock() en un spin_lock() sin coste extra.
+ */
+struct bench_lock_stats {
+	u64 nr;
+	u64 wait_ns;
+	u64 hold_ns;
+};
+
+static DEFINE_STATIC_KEY_FALSE(bench_key);
+static DEFINE_PER_CPU(struct bench_lock_stats, bench_lock);
+
+/* Devuelve el instante en que se cogio el cerrojo (0 si no se esta midiendo) */
+static u64 bench_spin_lock(spinlock_t *lock){
+	u64 t0, t1;
+
+	if (!static_branch_unlikely(&bench_key)){
+		spin_lock(lock);
+		return 0;
+	}
+	t0 = ktime_get_ns();
+	spin_lock(lock);
+	t1 = ktime_get_ns();
+	this_cpu_inc(bench_lock.nr);
+	this_cpu_add(bench_lock.wait_ns, t1 - t0);
+	return t1;
+}
+
+static void bench_spin_unlock(spinlock_t *lock, u64 locked){
+	if (locked)
+		this_cpu_add(bench_lock.hold_ns, ktime_get_ns() - locked);
+	spin_unlock(lock);
+}
+
+static void modlist_free_rcu(struct rcu_head *head){
+	kmem_cache_free(item_cache, container_of(head, struct list_item, rcu));
+}
+
+/* Saca un nodo de su lista y programa su liberacion. Llamar con el cerrojo de la lista */
+static void modlist_unlink(struct list_item *item, unsigned int *count){
+	if (!item->cursor){
+		hash_del(&(item->hash));
+		(*count)--;
+	}
+	list_del_rcu(&(item->links));
+	call_rcu(&(item->rcu), modlist_free_rcu);
+}
+
+/* Lista y cerrojo de cada sublista; en modo list solo hay una (mylist, mtx) */
+static struct list_head *modlist_head(int cpu){
+	return sharded_mode ? &(per_cpu_ptr(shards, cpu)->list) : &mylist;
+}
+
+static spinlock_t *modlist_lock(int cpu){
+	return sharded_mode ? &(per_cpu_ptr(shards, cpu)->lock) : &mtx;
+}
+
+static int modlist_first_shard(void){
+	return sharded_mode ? cpumask_first(cpu_possible_mask) : 0;
+}
+
+static int modlist_next_shard(int cpu){
+	return sharded_mode ? cpumask_next(cpu, cpu_possible_mask) : nr_cpu_ids;
+}
+
+#define for_each_modlist_shard(cpu) \
+	for ((cpu) = modlist_first_shard(); (cpu) < nr_cpu_ids; (cpu) = modlist_next_shard(cpu))
+
+enum modlist_op { MODLIST_ADD, MODLIST_REMOVE, MODLIST_CLEANUP, MODLIST_RANGE };
+
+/* Comando ya traducido; los add llevan su nodo reservado antes de coger mtx */
+struct modlist_cmd {
+	enum modlist_op op;
+	int num;
+	int hi;		// solo range
+	struct list_item *item;
+};
+
+static unsigned int nr_commands = 0;	// comandos aplicados desde la carga (protegido por mtx)
+
+module_param_cb(nr_commands, &modlist_counter_ops, &nr_commands, 0444);
+MODULE_PARM_DESC(nr_commands, "Commands applied through /proc/modlist since the module was loaded");
+
+/* Saca de head todos los datos. Llamar con el cerrojo de la lista */
+static void modlist_unlink_all(struct list_head *head, unsigned int *count){
+	struct list_item *it, *item = NULL;
+	list_for_each_entry_safe(item, it, head, links){ // esto recorre las entradas de la lista
+		if (item->cursor) // los marcadores pertenecen a los lectores
+			continue;
+		modlist_unlink(item, count);
+	}
+}
+
+static void shard_remove(int num){
+	struct modlist_shard *shard;
+	struct list_item *item = NULL;
+	struct hlist_node *tmp = NULL;
+	u64 locked;
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		shard = per_cpu_ptr(shards, cpu);
+		locked = bench_spin_lock(&shard->lock);
+		hash_for_each_possible_safe(shard->hash, item, tmp, hash, num){
+			if (item->data == num)
+				modlist_unlink(item, &shard->nr_items);
+		}
+		bench_spin_unlock(&shard->lock, locked);
+	}
+}
+
+static void shard_cleanup(void){
+	struct modlist_shard *shard;
+	u64 locked;
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		shard = per_cpu_ptr(shards, cpu);
+		locked = bench_spin_lock(&shard->lock);
+		modlist_unlink_all(&shard->list, &shard->nr_items);
+		bench_spin_unlock(&shard->lock, locked);
+	}
+}
+
+/*
+ * Los add van a la sublista de la CPU en la que corre el escritor (si despues
+ * migra da igual: el cerrojo es el de la sublista, no el de la CPU). remove y
+ * cleanup sueltan ese cerrojo y visitan las sublistas de una en una, nunca se
+ * tienen dos cerrojos a la vez.
+ */
+static void shard_apply(struct modlist_cmd *cmds, int n){
+	struct modlist_shard *shard = raw_cpu_ptr(shards);
+	struct list_item *item = NULL;
+	u64 locked;
+	int i;
+
+	locked = bench_spin_lock(&shard->lock);
+	for (i = 0; i < n; i++){
+		switch (cmds[i].op){
+		case MODLIST_ADD:
+			item = cmds[i].item;
+			list_add_tail_rcu(&(item->links), &shard->list);
+			hash_add(shard->hash, &(item->hash), item->data);
+			shard->nr_items++;
+			break;
+		case MODLIST_REMOVE:
+		case MODLIST_CLEANUP:
+			bench_spin_unlock(&shard->lock, locked);
+			if (cmds[i].op == MODLIST_REMOVE)
+				shard_remove(cmds[i].num);
+			else
+				shard_cleanup();
+			locked = bench_spin_lock(&shard->lock);
+			break;
+		case MODLIST_RANGE:
+			break;
+		}
+	}
+	shard->nr_commands += n;
+	bench_spin_unlock(&shard->lock, locked);
+}
+
+/*
+ * Modo sorted: los datos se guardan en un rbtree ordenado por (valor, orden de
+ * insercion), un multiconjunto con add/remove en O(log n). Los lectores cogen
+ * mtx entre start() y stop() (una pagina) y retoman la lectura buscando la
+ * clave del siguiente elemento, tambien en O(log n).
+ */
+static struct rb_root modlist_tree = RB_ROOT;
+static u64 next_seq = 0;	// orden de insercion, desempata valores repetidos (protegido por mtx)
+
+static int tree_cmp(int data, u64 seq, struct list_item *item){
+	if (data != item->data)
+		return data < item->data ? -1 : 1;
+	if (seq != item->seq)
+		return seq < item->seq ? -1 : 1;
+	return 0;
+}
+
+/* Primer nodo con clave >= (data, seq) */
+static struct list_item *tree_lower_bound(int data, u64 seq){
+	struct rb_node *node = modlist_tree.rb_node;
+	struct list_item *item, *found = NULL;
+
+	while (node){
+		item = rb_entry(node, struct list_item, node);
+		if (tree_cmp(data, seq, item) <= 0){
+			found = item;
+			node = node->rb_left;
+		}
+		else
+			node = node->rb_right;
+	}
+	return found;
+}
+
+static struct list_item *tree_next(struct list_item *item){
+	struct rb_node *node = rb_next(&(item->node));
+	return node ? rb_entry(node, struct list_item, node) : NULL;
+}
+
+static void tree_add(struct list_item *item){
+	struct rb_node **link = &(modlist_tree.rb_node), *parent = NULL;
+
+	item->seq = next_seq++;
+	while (*link){
+		parent = *link;
+		if (tree_cmp(item->data, item->seq, rb_entry(parent, struct list_item, node)) < 0)
+			link = &(parent->rb_left);
+		else
+			link = &(parent->rb_right);
+	}
+	rb_link_node(&(item->node), parent, link);
+	rb_insert_color(&(item->node), &modlist_tree);
+	nr_items++;
+}
+
+static void tree_remove(int num){
+	struct list_item *next, *item = tree_lower_bound(num, 0);
+
+	while (item && item->data == num){
+		next = tree_next(item);
+		rb_erase(&(item->node), &modlist_tree);
+		kmem_cache_free(item_cache, item);
+		nr_items--;
+		item = next;
+	}
+}
+
+static void tree_cleanup(void){
+	struct list_item *it, *item = NULL;
+
+	rbtree_postorder_for_each_entry_safe(item, it, &modlist_tree, node)
+		kmem_cache_free(item_cache, item);
+	modlist_tree = RB_ROOT;
+	nr_items = 0;
+}
+
 void modlist_cleanup ( void ){
 	/* cleanup de la lista */
-	struct list_item *it, *item = NULL;
 	// commit P4 
-	spin_lock(&mtx);
-	list_for_each_entry_safe(item, it, &mylist, links){ // esto recorre las entradas de la lista
-		list_del(&(item->links));
-		vfree(item);
+	if (sharded_mode){
+		shard_cleanup();
+		return;
 	}
+	spin_lock(&mtx);
+	if (sorted_mode)
+		tree_cleanup();
+	else
+		modlist_unlink_all(&mylist, &nr_items);
 	spin_unlock(&mtx);
 	/************************/
 }
 
-static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
-
-	int available_space = COMMANDS_LENGTH-1;
-	char command_buf[COMMANDS_LENGTH];
-	int num;
-	
+/* Aplica n comandos con una sola toma de mtx */
+static void modlist_apply(struct modlist_cmd *cmds, int n){
 	struct list_item *item = NULL;
+	struct hlist_node *tmp = NULL;
+	u64 locked;
+	int i;
 
-	if ((*off) > 0) /* The application can write in this entry just once !! */
+	if (sharded_mode){
+		shard_apply(cmds, n);
+		return;
+	}
+
+	locked = bench_spin_lock(&mtx);
+	for (i = 0; i < n; i++){
+		switch (cmds[i].op){
+		case MODLIST_ADD:
+			item = cmds[i].item;
+			if (sorted_mode){
+				tree_add(item);
+				break;
+			}
+			list_add_tail_rcu(&(item->links), &mylist);
+			hash_add(modlist_hash, &(item->hash), item->data);
+			nr_items++;
+			break;
+		case MODLIST_REMOVE:
+			if (sorted_mode){
+				tree_remove(cmds[i].num);
+				break;
+			}
+			hash_for_each_possible_safe(modlist_hash, item, tmp, hash, cmds[i].num){
+				if(item->data == cmds[i].num)
+					modlist_unlink(item, &nr_items);
+			}
+			break;
+		case MODLIST_CLEANUP:
+			if (sorted_mode)
+				tree_cleanup();
+			else
+				modlist_unlink_all(&mylist, &nr_items);
+			break;
+		case MODLIST_RANGE:
+			break;
+		}
+	}
+	nr_commands += n;
+	bench_spin_unlock(&mtx, locked);
+}
+
+static struct list_item *modlist_new_item(int num){
+	struct list_item *item = kmem_cache_alloc(item_cache, GFP_KERNEL);
+	if (!item)
+		return NULL;
+	item->data = num;
+	item->cursor = 0;
+	return item;
+}
+
+/* Traduce una linea (sin '\n') a un comando */
+static int modlist_parse(char *line, struct modlist_cmd *cmd){
+	if (strncmp(line, "add ", 4) == 0){
+		cmd->op = MODLIST_ADD;
+		if (kstrtoint(skip_spaces(line + 4), 10, &(cmd->num)))
+			return -EINVAL;
+		cmd->item = modlist_new_item(cmd->num);
+		return cmd->item ? 0 : -ENOMEM;
+	}
+	if (strncmp(line, "remove ", 7) == 0){
+		cmd->op = MODLIST_REMOVE;
+		return kstrtoint(skip_spaces(line + 7), 10, &(cmd->num)) ? -EINVAL : 0;
+	}
+	if (strcmp(line, "cleanup") == 0){
+		cmd->op = MODLIST_CLEANUP;
 		return 0;
+	}
+	if (strncmp(line, "range ", 6) == 0){
+		char *lo = skip_spaces(line + 6);
+		char *hi = strchr(lo, ' ');
 
-	if (len > available_space) {
-		printk(KERN_INFO "modlist: command not enough space!!\n");
-		return -ENOSPC;
+		cmd->op = MODLIST_RANGE;
+		if (!hi)
+			return -EINVAL;
+		*hi = '\0';
+		if (kstrtoint(lo, 10, &(cmd->num)) || kstrtoint(skip_spaces(hi + 1), 10, &(cmd->hi)))
+			return -EINVAL;
+		return cmd->num <= cmd->hi ? 0 : -EINVAL;
 	}
+	return -EINVAL;
+}
 
-	/* Transfer data from user to kernel space */
-	if (copy_from_user( command_buf, buf, len ))  
-		return -EFAULT;
+/*
+ * range A B solo afecta a quien lo escribe: las siguientes lecturas por el
+ * mismo descriptor empiezan de nuevo y muestran solo los valores de [A, B].
+ */
+static void modlist_set_range(struct file *filp, int lo, int hi, loff_t *off){
+	struct seq_file *m = filp->private_data;
+	struct modlist_iter *iter = m->private;
 
-	command_buf[len] = '\0'; /* Add the `\0' */ 
-	*off+=len;            /* Update the file pointer */
-	
-	trace_printk("Modlist: Current command: %s", command_buf);
-	 
-	if(sscanf(command_buf, "add %d", &num) == 1) {
-		item = (struct list_item *) vmalloc(sizeof (struct list_item));
-		if (!item)
-			return -ENOMEM;
-			
-		// commit P4 
-		spin_lock(&mtx);
-		item->data = num;
-		list_add_tail(&(item->links), &mylist);
-		spin_unlock(&mtx);
-	}
-	else if(sscanf(command_buf, "remove %d", &num) == 1){
-		struct list_item *it = NULL;
-		// commit P4 
-		spin_lock(&mtx);
-		list_for_each_entry_safe(item, it, &mylist, links){
-			if(item->data == num){
-				list_del(&(item->links));
-				vfree(item);
+	mutex_lock(&(m->lock));
+	iter->lo = lo;
+	iter->hi = hi;
+	iter->cursor_pos = -1;
+	mutex_unlock(&(m->lock));
+	*off = 0;
+}
+
+/*
+ * Admite lotes de comandos separados por '\n' de cualquier tamaño en un solo
+ * write(): "add 1\nadd 2\nremove 7\n...". El texto se copia por paginas y los
+ * comandos se aplican de MAX_BATCH_CMDS en MAX_BATCH_CMDS, cada grupo con una
+ * sola toma de mtx. Los comandos aplicados se acumulan en nr_commands. Los
+ * buffers se ajustan a len: un "echo add N" no pide mas que unos bytes.
+ */
+static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
+
+	char *kbuf = NULL;
+	struct modlist_cmd *cmds = NULL;
+	size_t copied = 0;		// bytes de buf ya copiados
+	size_t consumed = 0;	// bytes de buf de lineas ya procesadas
+	size_t pending = 0;		// trozo de linea incompleta al principio de kbuf
+	size_t buf_len = min_t(size_t, len + 1, BATCH_LENGTH);
+	size_t max_cmds = min_t(size_t, len / MIN_COMMAND_LENGTH + 1, MAX_BATCH_CMDS);
+	unsigned int applied = 0;
+	char *line, *end, *nl;
+	int n = 0, err = 0;
+
+	kbuf = kmalloc(buf_len, GFP_KERNEL);
+	cmds = kmalloc(sizeof(struct modlist_cmd) * max_cmds, GFP_KERNEL);
+	if (!kbuf || !cmds){
+		err = -ENOMEM;
+		goto out;
+	}
+
+	while (copied < len){
+		size_t chunk = min_t(size_t, len - copied, buf_len - 1 - pending);
+
+		/* Transfer data from user to kernel space */
+		if (copy_from_user(kbuf + pending, buf + copied, chunk)){
+			err = -EFAULT;
+			goto out;
+		}
+		copied += chunk;
+		end = kbuf + pending + chunk;
+		*end = '\0';
+
+		line = kbuf;
+		while (line < end){
+			nl = memchr(line, '\n', end - line);
+			if (!nl && copied < len) // la linea sigue en el siguiente trozo
+				break;
+			if (nl)
+				*nl = '\0';
+
+			if (*line){
+				err = modlist_parse(line, &cmds[n]);
+				if (err == -ENOMEM)
+					goto out;
+				/* un range mal escrito se devuelve como error: cambiaria lo que se lee despues */
+				if (err == -EINVAL && strncmp(line, "range ", 6) == 0)
+					goto out;
+				if (err == 0 && cmds[n].op == MODLIST_RANGE){
+					modlist_set_range(filp, cmds[n].num, cmds[n].hi, off);
+					applied++;
+				}
+				else if (err == 0 && ++n == max_cmds){
+					modlist_apply(cmds, n);
+					applied += n;
+					n = 0;
+				}
+				if (err == -EINVAL)
+					printk_ratelimited(KERN_INFO "ERROR: comando inválido.\n");
+				err = 0;
 			}
+			line = nl ? nl + 1 : end;
+			consumed = copied - (end - line);
+		}
+
+		pending = end - line;
+		if (pending >= COMMANDS_LENGTH){
+			printk(KERN_INFO "modlist: command not enough space!!\n");
+			err = -ENOSPC;
+			goto out;
+		}
+		memmove(kbuf, line, pending);
+	}
+out:
+	if (n){
+		modlist_apply(cmds, n);
+		applied += n;
+	}
+	kfree(kbuf);
+	kfree(cmds);
+
+	trace_printk("Modlist: %u commands applied in %zu bytes\n", applied, consumed);
+
+	/* si algo se aplico se informa de lo consumido; el resto se puede reintentar */
+	if (err && !consumed)
+		return err;
+	return consumed;
+}
+
+/*
+ * Lectura con seq_file: cada llamada a read() formatea como mucho una pagina
+ * recorriendo mylist dentro de rcu_read_lock(), sin bloquear a los escritores.
+ * Al parar se deja un marcador nuevo delante del siguiente elemento (lo unico
+ * que necesita mtx, y es O(1)), asi la siguiente lectura continua en O(1)
+ * aunque otros hayan borrado elementos mientras tanto. Los marcadores no se
+ * mueven nunca: el anterior se saca de la lista y se libera con RCU, porque
+ * otro lector puede estar pasando por el. En modo sharded se recorren las
+ * sublistas una detras de otra y el marcador se deja en la del elemento.
+ */
+
+/*
+ * Siguiente dato despues de node (que esta en la sublista iter->shard),
+ * saltando marcadores y valores fuera de rango
+ */
+static struct list_item *modlist_next_item(struct modlist_iter *iter, struct list_head *node){
+	struct list_head *head = modlist_head(iter->shard);
+	struct list_item *item = NULL;
+	int cpu;
+
+	for (;;){
+		for (node = rcu_dereference(list_next_rcu(node)); node != head;
+		     node = rcu_dereference(list_next_rcu(node))){
+			item = list_entry(node, struct list_item, links);
+			if (!item->cursor && item->data >= iter->lo && item->data <= iter->hi)
+				return item;
+		}
+		/* fin de la sublista: se sigue por la de la siguiente CPU */
+		cpu = modlist_next_shard(iter->shard);
+		if (cpu >= nr_cpu_ids)
+			return NULL;
+		iter->shard = cpu;
+		node = head = modlist_head(cpu);
+	}
+}
+
+static void *modlist_start(struct seq_file *f, loff_t *pos){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = NULL;
+	loff_t i;
+
+	/* el marcador se reserva aqui porque en stop() no se puede dormir */
+	if (!iter->spare){
+		iter->spare = kmem_cache_alloc(item_cache, GFP_KERNEL);
+		if (iter->spare)
+			iter->spare->cursor = 1;
+	}
+
+	rcu_read_lock();
+	if (!iter->spare)
+		return ERR_PTR(-ENOMEM);
+	iter->pos = *pos;
+
+	if (*pos && *pos == iter->cursor_pos){ /* continuar donde paro la lectura anterior */
+		iter->shard = iter->cursor_shard;
+		return modlist_next_item(iter, &(iter->cursor->links));
+	}
+
+	/* primera lectura o lseek: recorrido desde el principio */
+	iter->shard = modlist_first_shard();
+	item = modlist_next_item(iter, modlist_head(iter->shard));
+	for (i = 0; item && i < *pos; i++)
+		item = modlist_next_item(iter, &(item->links));
+	return item;
+}
+
+static void *modlist_next(struct seq_file *f, void *v, loff_t *pos){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = v;
+
+	(*pos)++;
+	iter->pos = *pos;
+	return modlist_next_item(iter, &(item->links));
+}
+
+static void modlist_stop(struct seq_file *f, void *v){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = v;
+	struct list_item *old = iter->cursor;
+	int old_shard = iter->cursor_shard;
+	spinlock_t *lock = modlist_lock(iter->shard);
+
+	if (IS_ERR(item)){
+		rcu_read_unlock();
+		return;
+	}
+
+	spin_lock(lock);
+	/* v es el primer elemento sin mostrar (NULL si se llego al final) */
+	if (item && item->links.prev == LIST_POISON2){
+		/* lo acaban de borrar: la siguiente lectura recorre desde el principio */
+		iter->cursor = NULL;
+		iter->cursor_pos = -1;
+	}
+	else {
+		iter->cursor = iter->spare;
+		iter->spare = NULL;
+		list_add_tail_rcu(&(iter->cursor->links), item ? &(item->links) : modlist_head(iter->shard));
+		iter->cursor_pos = iter->pos;
+		iter->cursor_shard = iter->shard;
+	}
+	spin_unlock(lock);
+	if (old){
+		lock = modlist_lock(old_shard);
+		spin_lock(lock);
+		modlist_unlink(old, NULL);
+		spin_unlock(lock);
+	}
+	rcu_read_unlock();
+}
+
+static int modlist_show(struct seq_file *f, void *v){
+	struct list_item *item = v;
+	seq_printf(f, "%d\n", item->data);
+	return 0;
+}
+
+static const struct seq_operations modlist_op = {
+	.start = modlist_start,
+	.next = modlist_next,
+	.stop = modlist_stop,
+	.show = modlist_show
+};
+
+static void *tree_start(struct seq_file *f, loff_t *pos){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = NULL;
+	loff_t i;
+
+	spin_lock(&mtx);
+	iter->pos = *pos;
+
+	if (*pos && *pos == iter->cursor_pos) /* continuar donde paro la lectura anterior */
+		item = tree_lower_bound(iter->next_data, iter->next_seq);
+	else {
+		/* primera lectura o lseek: desde el principio del rango */
+		iter->cursor_pos = -1;
+		item = tree_lower_bound(iter->lo, 0);
+		for (i = 0; item && i < *pos; i++)
+			item = tree_next(item);
+	}
+	return (item && item->data <= iter->hi) ? item : NULL;
+}
+
+static void *tree_next_op(struct seq_file *f, void *v, loff_t *pos){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = v;
+
+	(*pos)++;
+	iter->pos = *pos;
+	/* si este era el ultimo, se continuara por lo que venga detras de el */
+	iter->next_data = item->data;
+	iter->next_seq = item->seq + 1;
+	iter->cursor_pos = *pos;
+
+	item = tree_next(item);
+	return (item && item->data <= iter->hi) ? item : NULL;
+}
+
+static void tree_stop(struct seq_file *f, void *v){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = v;
+
+	/* v es el primer elemento sin mostrar (NULL si se llego al final) */
+	if (item){
+		iter->next_data = item->data;
+		iter->next_seq = item->seq;
+		iter->cursor_pos = iter->pos;
+	}
+	spin_unlock(&mtx);
+}
+
+static const struct seq_operations tree_op = {
+	.start = tree_start,
+	.next = tree_next_op,
+	.stop = tree_stop,
+	.show = modlist_show
+};
+
+static int modlist_open(struct inode *inode, struct file *file){
+	struct modlist_iter *iter = __seq_open_private(file, sorted_mode ? &tree_op : &modlist_op,
+			sizeof(struct modlist_iter));
+	if (!iter)
+		return -ENOMEM;
+	iter->cursor_pos = -1;
+	iter->lo = INT_MIN;
+	iter->hi = INT_MAX;
+	return 0;
+}
+
+static int modlist_release(struct inode *inode, struct file *file){
+	struct modlist_iter *iter = ((struct seq_file *)file->private_data)->private;
+
+	if (iter->cursor){
+		spinlock_t *lock = modlist_lock(iter->cursor_shard);
+		spin_lock(lock);
+		modlist_unlink(iter->cursor, NULL);
+		spin_unlock(lock);
+	}
+	if (iter->spare)
+		kmem_cache_free(item_cache, iter->spare);
+	return seq_release_private(inode, file);
+}
+
+static const struct file_operations proc_entry_fops = {
+    .open = modlist_open,
+    .read = seq_read,
+    .write = modlist_write,
+    .llseek = seq_lseek,
+    .release = modlist_release
+};
+
+/*
+ * Interfaz binaria /dev/modlist (ver modlist_ioctl.h): misma lista que
+ * /proc/modlist, pero los enteros llegan y salen como arrays de int32.
+ */
+
+static dev_t start;
+static struct cdev *modlist_cdev = NULL;
+
+/* Añade count enteros de un array de usuario, de MAX_BATCH_CMDS en MAX_BATCH_CMDS */
+static long modlist_add_user(const int __user *data, size_t count, size_t *done){
+	struct modlist_cmd *cmds = NULL;
+	int *nums = NULL;
+	size_t n, i;
+	long err = 0;
+
+	*done = 0;
+	cmds = kmalloc(sizeof(struct modlist_cmd) * min_t(size_t, count, MAX_BATCH_CMDS), GFP_KERNEL);
+	nums = kmalloc(sizeof(int) * min_t(size_t, count, MAX_BATCH_CMDS), GFP_KERNEL);
+	if (!cmds || !nums){
+		err = -ENOMEM;
+		goto out;
+	}
+
+	while (*done < count){
+		n = min_t(size_t, count - *done, MAX_BATCH_CMDS);
+		if (copy_from_user(nums, data + *done, n * sizeof(int))){
+			err = -EFAULT;
+			goto out;
+		}
+		for (i = 0; i < n; i++){
+			cmds[i].op = MODLIST_ADD;
+			cmds[i].num = nums[i];
+			cmds[i].item = modlist_new_item(nums[i]);
+			if (!cmds[i].item)
+				break;
+		}
+		if (i)
+			modlist_apply(cmds, i);
+		*done += i;
+		if (i < n){
+			err = -ENOMEM;
+			goto out;
 		}
-		spin_unlock(&mtx);
 	}
-	else if(strncmp(command_buf, "cleanup\n", len) == 0){
-		modlist_cleanup();
+out:
+	kfree(cmds);
+	kfree(nums);
+	return err;
+}
+
+/* Copia a snap hasta count datos, en el orden en que los muestra cat */
+static size_t modlist_snapshot(int *snap, size_t count){
+	struct list_item *item = NULL;
+	size_t n = 0;
+	u64 locked;
+	int cpu;
+
+	if (sorted_mode){
+		locked = bench_spin_lock(&mtx);
+		for (item = tree_lower_bound(INT_MIN, 0); item && n < count; item = tree_next(item))
+			snap[n++] = item->data;
+		bench_spin_unlock(&mtx, locked);
 	}
 	else {
-		printk(KERN_INFO "ERROR: comando inválido.\n");
+		rcu_read_lock();
+		for_each_modlist_shard(cpu){
+			list_for_each_entry_rcu(item, modlist_head(cpu), links){
+				if (item->cursor)
+					continue;
+				if (n == count)
+					break;
+				snap[n++] = item->data;
+			}
+		}
+		rcu_read_unlock();
 	}
-	return len;
+	return n;
 }
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  
-	int nr_bytes, total_bytes = 0, wt_bytes = 0, to_wt = 0;			// nr_bytes: aux, total_bytes: return value, wt_bytes: bytes to write, to_wt: max bytes can write on buffer 
-	struct list_item *it, *item = NULL; 							// iterator and temp value
-	char rd_buf[TEMP_BUFFER_LENGTH];								// temp buffer
-	char data_buf[MAX_SIZE];										// aux buffer, number to char 
-	char *ptr_rdbuf = rd_buf, *ptr_buf = buf, *ptr_data = data_buf; // as names indicate
-	
-	if ((*off) > 0) /* Tell the application that there is nothing left to read */
+/* Copia hasta count datos (en el orden en que los muestra cat) a un array de usuario */
+static long modlist_dump_user(int __user *data, size_t count, size_t *done){
+	int *snap;
+	size_t n;
+
+	*done = 0;
+	count = min_t(size_t, count, modlist_total(&nr_items));
+	if (!count)
 		return 0;
-	
-	// commit P4 
-	spin_lock(&mtx);
-	list_for_each_entry_safe(item, it, &mylist, links){
-		
-		nr_bytes = ptr_rdbuf - rd_buf;
-		to_wt = TEMP_BUFFER_LENGTH - nr_bytes;
-		
-		if ( to_wt < sprintf(ptr_data, "%d\n", item->data)){
-			trace_printk("Modlist: Looping on buffer: %d out %d.\n", nr_bytes, TEMP_BUFFER_LENGTH);
-			do {
-				wt_bytes = snprintf(ptr_rdbuf, to_wt, ptr_data);
-				if (copy_to_user(ptr_buf, rd_buf, TEMP_BUFFER_LENGTH)){
-					spin_unlock(&mtx);
-					return -EINVAL;
-				}
-				ptr_buf += TEMP_BUFFER_LENGTH - 1;		
-				ptr_rdbuf = rd_buf;
-				ptr_data += to_wt - 1;
-				total_bytes += TEMP_BUFFER_LENGTH - 1;
-				wt_bytes -= to_wt - 1;
-				to_wt = TEMP_BUFFER_LENGTH;
-			}while (TEMP_BUFFER_LENGTH <= wt_bytes);
+
+	/* copy_to_user puede dormir: primero una foto de la lista bajo RCU */
+	snap = vmalloc(count * sizeof(int));
+	if (!snap)
+		return -ENOMEM;
+	n = modlist_snapshot(snap, count);
+
+	if (copy_to_user(data, snap, n * sizeof(int))){
+		vfree(snap);
+		return -EFAULT;
+	}
+	vfree(snap);
+	*done = n;
+	return 0;
+}
+
+static long modlist_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
+	struct modlist_array arr;
+	struct modlist_cmd op;
+	size_t done = 0;
+	long err = 0;
+	int num;
+
+	switch (cmd){
+	case MODLIST_IOC_ADD:
+		if (get_user(num, (int __user *)arg))
+			return -EFAULT;
+		op.op = MODLIST_ADD;
+		op.num = num;
+		op.item = modlist_new_item(num);
+		if (!op.item)
+			return -ENOMEM;
+		modlist_apply(&op, 1);
+		return 0;
+	case MODLIST_IOC_REMOVE:
+		if (get_user(num, (int __user *)arg))
+			return -EFAULT;
+		op.op = MODLIST_REMOVE;
+		op.num = num;
+		modlist_apply(&op, 1);
+		return 0;
+	case MODLIST_IOC_CLEANUP:
+		op.op = MODLIST_CLEANUP;
+		modlist_apply(&op, 1);
+		return 0;
+	case MODLIST_IOC_ADD_BULK:
+	case MODLIST_IOC_DUMP:
+		if (copy_from_user(&arr, (void __user *)arg, sizeof(arr)))
+			return -EFAULT;
+		if (cmd == MODLIST_IOC_ADD_BULK)
+			err = modlist_add_user(u64_to_user_ptr(arr.data), arr.count, &done);
+		else
+			err = modlist_dump_user(u64_to_user_ptr(arr.data), arr.count, &done);
+		arr.done = done;
+		arr.total = modlist_total(&nr_items);
+		if (copy_to_user((void __user *)arg, &arr, sizeof(arr)))
+			return -EFAULT;
+		return (err && !done) ? err : 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+/*
+ * Un modlist_user de 32 bits en un kernel de 64: modlist_array tiene el
+ * mismo tamaño y formato (data es __u64), solo hay que convertir arg.
+ */
+static long modlist_compat_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
+	return modlist_ioctl(filp, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+
+/* write() de un array de int32 empaquetado: add de todos sus elementos */
+static ssize_t modlist_dev_write(struct file *filp, const char __user *buf, size_t len, loff_t *off){
+	size_t done = 0;
+	long err;
+
+	if (len % sizeof(int))
+		return -EINVAL;
+
+	err = modlist_add_user((const int __user *)buf, len / sizeof(int), &done);
+	if (err && !done)
+		return err;
+	return done * sizeof(int);
+}
+
+static const struct file_operations dev_fops = {
+    .owner = THIS_MODULE,
+    .write = modlist_dev_write,
+    .unlocked_ioctl = modlist_ioctl,
+#ifdef CONFIG_COMPAT
+    .compat_ioctl = modlist_compat_ioctl,
+#endif
+};
+
+static int modlist_chardev_init(void){
+	int ret;
+
+	/* Get available (major,minor) range */
+	if ((ret = alloc_chrdev_region(&start, 0, 1, MODLIST_DEVICE_NAME))) {
+		printk(KERN_INFO "Modlist: Can't allocate chrdev_region()\n");
+		return ret;
+	}
+
+	/* Create associated cdev */
+	if ((modlist_cdev = cdev_alloc()) == NULL) {
+		printk(KERN_INFO "Modlist: cdev_alloc() failed\n");
+		unregister_chrdev_region(start, 1);
+		return -ENOMEM;
+	}
+	modlist_cdev->owner = THIS_MODULE;
+	modlist_cdev->ops = &dev_fops;
+
+	if ((ret = cdev_add(modlist_cdev, start, 1))) {
+		printk(KERN_INFO "Modlist: cdev_add() failed\n");
+		kobject_put(&modlist_cdev->kobj);
+		unregister_chrdev_region(start, 1);
+		return ret;
+	}
+
+	printk(KERN_INFO "Modlist: binary interface with 'sudo mknod -m 666 /dev/%s c %d %d'\n",
+		MODLIST_DEVICE_NAME, MAJOR(start), MINOR(start));
+	return 0;
+}
+
+static void modlist_chardev_exit(void){
+	cdev_del(modlist_cdev);
+	unregister_chrdev_region(start, 1);
+}
+
+/*
+ * Benchmark dentro del kernel (debugfs): K kthreads (los <hilos> del
+ * comando, fijados por turnos a las CPU en linea) llaman directamente a
+ * modlist_apply()/modlist_snapshot(), sin el coste de las llamadas al sistema
+ * ni del parseo de texto. Uso (como root):
+ *   echo "add 4 100000" > /sys/kernel/debug/modlist/bench   # op hilos ops_por_hilo
+ *   cat /sys/kernel/debug/modlist/bench
+ * Operaciones: add (valores distintos por hilo), remove (los mismos valores
+ * que un add anterior con los mismos parametros), read (foto completa de la
+ * lista, como un dump) y cleanup. El write vuelve cuando acaban los hilos.
+ */
+
+#define BENCH_MAX_THREADS	64
+#define BENCH_MAX_SAMPLES	(1 << 22)	// latencias guardadas por ejecucion (16MB)
+#define BENCH_RESULT_LENGTH	512
+
+enum bench_op { BENCH_ADD, BENCH_REMOVE, BENCH_READ, BENCH_CLEANUP };
+
+static const char * const bench_op_names[] = { "add", "remove", "read", "cleanup" };
+
+struct bench_run {
+	enum bench_op op;
+	unsigned int ops;		// operaciones de cada hilo
+	u32 *lat;				// latencia de cada operacion en ns, ops por hilo
+	atomic_t pending;		// hilos sin terminar
+	struct completion done;
+};
+
+struct bench_thread {
+	struct bench_run *run;
+	struct task_struct *task;
+	int id;
+	int *snap;				// solo read
+	size_t snap_len;
+	u64 start, end;
+};
+
+static struct dentry *bench_dir = NULL;
+static DEFINE_MUTEX(bench_mtx);	// una ejecucion a la vez; protege bench_result
+static char bench_result[BENCH_RESULT_LENGTH] = "no benchmark run yet\n";
+
+static void bench_one(struct bench_thread *t, unsigned int i){
+	struct modlist_cmd cmd;
+	int num = t->id * t->run->ops + i;
+
+	switch (t->run->op){
+	case BENCH_ADD:
+		cmd.op = MODLIST_ADD;
+		cmd.num = num;
+		cmd.item = modlist_new_item(num);
+		if (cmd.item)
+			modlist_apply(&cmd, 1);
+		break;
+	case BENCH_REMOVE:
+		cmd.op = MODLIST_REMOVE;
+		cmd.num = num;
+		modlist_apply(&cmd, 1);
+		break;
+	case BENCH_READ:
+		modlist_snapshot(t->snap, t->snap_len);
+		break;
+	case BENCH_CLEANUP:
+		cmd.op = MODLIST_CLEANUP;
+		modlist_apply(&cmd, 1);
+		break;
+	}
+}
+
+static int bench_thread_fn(void *arg){
+	struct bench_thread *t = arg;
+	struct bench_run *run = t->run;
+	u32 *lat = run->lat + (size_t)t->id * run->ops;
+	u64 t0, t1;
+	unsigned int i;
+
+	t->start = ktime_get_ns();
+	for (i = 0; i < run->ops; i++){
+		t0 = ktime_get_ns();
+		bench_one(t, i);
+		t1 = ktime_get_ns();
+		lat[i] = min_t(u64, t1 - t0, U32_MAX);
+		cond_resched();
+	}
+	t->end = ktime_get_ns();
+
+	if (atomic_dec_and_test(&run->pending))
+		complete(&run->done);
+	/* el que lanzo el benchmark nos para con kthread_stop() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()){
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int bench_cmp(const void *a, const void *b){
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Percentil p (en milesimas) de n latencias ya ordenadas */
+static u32 bench_pct(u32 *lat, size_t n, unsigned int p){
+	return lat[min_t(size_t, n * p / 1000, n - 1)];
+}
+
+static int bench_start(enum bench_op op, int nthreads, unsigned int ops){
+	struct bench_thread *threads = NULL;
+	struct bench_lock_stats lock = { 0 }, *st;
+	struct bench_run run;
+	size_t n = (size_t)nthreads * ops;
+	u64 start = U64_MAX, end = 0, ops_sec;
+	int i, cpu = -1, err = 0;
+
+	run.op = op;
+	run.ops = ops;
+	atomic_set(&run.pending, nthreads);
+	init_completion(&run.done);
+	run.lat = vmalloc(n * sizeof(u32));
+	threads = kcalloc(nthreads, sizeof(struct bench_thread), GFP_KERNEL);
+	if (!run.lat || !threads){
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nthreads; i++){
+		threads[i].run = &run;
+		threads[i].id = i;
+		if (op == BENCH_READ){
+			threads[i].snap_len = max_t(size_t, modlist_total(&nr_items), 1);
+			threads[i].snap = vmalloc(threads[i].snap_len * sizeof(int));
+			if (!threads[i].snap){
+				err = -ENOMEM;
+				goto out;
+			}
+		}
+		/* un hilo por CPU en linea, dando la vuelta si hay mas hilos que CPUs */
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		threads[i].task = kthread_create(bench_thread_fn, &threads[i], "modlist_bench/%d", i);
+		if (IS_ERR(threads[i].task)){
+			err = PTR_ERR(threads[i].task);
+			threads[i].task = NULL;
+			goto out;
 		}
-		ptr_rdbuf += sprintf(ptr_rdbuf, ptr_data);
-		ptr_data = data_buf;
+		kthread_bind(threads[i].task, cpu);
 	}
-	spin_unlock(&mtx);
-	total_bytes += ptr_rdbuf - rd_buf;
-		
-	if (len<total_bytes)
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&bench_lock, cpu), 0, sizeof(struct bench_lock_stats));
+	static_branch_enable(&bench_key);
+	for (i = 0; i < nthreads; i++)
+		wake_up_process(threads[i].task);
+	wait_for_completion(&run.done);
+	static_branch_disable(&bench_key);
+
+	for (i = 0; i < nthreads; i++){
+		start = min(start, threads[i].start);
+		end = max(end, threads[i].end);
+	}
+	for_each_possible_cpu(cpu){
+		st = per_cpu_ptr(&bench_lock, cpu);
+		lock.nr += st->nr;
+		lock.wait_ns += st->wait_ns;
+		lock.hold_ns += st->hold_ns;
+	}
+	sort(run.lat, n, sizeof(u32), bench_cmp, NULL);
+	ops_sec = div64_u64((u64)n * NSEC_PER_SEC, max_t(u64, end - start, 1));
+
+	scnprintf(bench_result, BENCH_RESULT_LENGTH,
+		"op %s, mode %s, %d threads x %u ops, %u items now\n"
+		"ops/s: %llu\n"
+		"latency ns: p50 %u p90 %u p99 %u p99.9 %u max %u\n"
+		"lock: %llu acquisitions, wait avg %llu ns (total %llu ms), hold avg %llu ns (total %llu ms)\n",
+		bench_op_names[op], mode, nthreads, ops, modlist_total(&nr_items),
+		ops_sec,
+		bench_pct(run.lat, n, 500), bench_pct(run.lat, n, 900), bench_pct(run.lat, n, 990),
+		bench_pct(run.lat, n, 999), run.lat[n - 1],
+		lock.nr, lock.nr ? div64_u64(lock.wait_ns, lock.nr) : 0, div64_u64(lock.wait_ns, NSEC_PER_MSEC),
+		lock.nr ? div64_u64(lock.hold_ns, lock.nr) : 0, div64_u64(lock.hold_ns, NSEC_PER_MSEC));
+out:
+	if (threads){
+		/* los que no llegaron a despertarse salen sin ejecutar bench_thread_fn */
+		for (i = 0; i < nthreads; i++){
+			if (threads[i].task)
+				kthread_stop(threads[i].task);
+			vfree(threads[i].snap);
+		}
+	}
+	kfree(threads);
+	vfree(run.lat);
+	return err;
+}
+
+static ssize_t bench_write(struct file *filp, const char __user *buf, size_t len, loff_t *off){
+	char kbuf[COMMANDS_LENGTH], name[16];
+	unsigned int ops;
+	int nthreads, op, err;
+
+	if (len >= COMMANDS_LENGTH)
 		return -ENOSPC;
+	if (copy_from_user(kbuf, buf, len))
+		return -EFAULT;
+	kbuf[len] = '\0';
 
-	/* Transfer data from the kernel to userspace */  
-	if (copy_to_user(ptr_buf, rd_buf, (ptr_rdbuf - rd_buf)))
+	if (sscanf(kbuf, "%15s %d %u", name, &nthreads, &ops) != 3)
+		return -EINVAL;
+	for (op = 0; op < ARRAY_SIZE(bench_op_names); op++)
+		if (strcmp(name, bench_op_names[op]) == 0)
+			break;
+	if (op == ARRAY_SIZE(bench_op_names) || nthreads <= 0 || nthreads > BENCH_MAX_THREADS ||
+	    !ops || (u64)nthreads * ops > BENCH_MAX_SAMPLES)
 		return -EINVAL;
 
-	(*off)+=total_bytes;  /* Update the file pointer */
-
-	return total_bytes; 
+	mutex_lock(&bench_mtx);
+	err = bench_start(op, nthreads, ops);
+	mutex_unlock(&bench_mtx);
+	return err ? err : len;
 }
 
+static ssize_t bench_read(struct file *filp, char __user *buf, size_t len, loff_t *off){
+	ssize_t ret;
 
-static const struct file_operations proc_entry_fops = {
-    .read = modlist_read,
-    .write = modlist_write,    
+	mutex_lock(&bench_mtx);
+	ret = simple_read_from_buffer(buf, len, off, bench_result, strlen(bench_result));
+	mutex_unlock(&bench_mtx);
+	return ret;
+}
+
+static const struct file_operations bench_fops = {
+    .owner = THIS_MODULE,
+    .read = bench_read,
+    .write = bench_write,
+    .llseek = default_llseek,
 };
 
 int init_modlist_module( void )
 {
-	int ret = 0;
+	int ret = 0, cpu;
+
+	if (strcmp(mode, "sorted") == 0)
+		sorted_mode = true;
+	else if (strcmp(mode, "sharded") == 0)
+		sharded_mode = true;
+	else if (strcmp(mode, "list") != 0){
+		printk(KERN_INFO "Modlist: unknown mode %s\n", mode);
+		return -EINVAL;
+	}
+
+	// commit P4
+	spin_lock_init(&mtx);
+	INIT_LIST_HEAD(&mylist);
+
+	item_cache = kmem_cache_create("modlist_item", sizeof(struct list_item), 0, 0, NULL);
+	if (!item_cache)
+		return -ENOMEM;
+
+	if (sharded_mode){
+		shards = alloc_percpu(struct modlist_shard);
+		if (!shards){
+			kmem_cache_destroy(item_cache);
+			return -ENOMEM;
+		}
+		for_each_possible_cpu(cpu){
+			struct modlist_shard *shard = per_cpu_ptr(shards, cpu);
+			spin_lock_init(&shard->lock);
+			INIT_LIST_HEAD(&shard->list);
+			hash_init(shard->hash);
+		}
+	}
 		
 	proc_entry = proc_create( "modlist", 0666, NULL, &proc_entry_fops);
 	if (proc_entry == NULL) {
-		ret = -ENOMEM;
+		free_percpu(shards);
+		kmem_cache_destroy(item_cache);
     	printk(KERN_INFO "Modlist: Can't create /proc entry\n");
-	} else {
-		// commit P4
-		spin_lock_init(&mtx);
-		
-		INIT_LIST_HEAD(&mylist);
-		printk(KERN_INFO "Modlist: Module loaded\n");
+		return -ENOMEM;
 	}
+
+	ret = modlist_chardev_init();
+	if (ret) {
+		remove_proc_entry("modlist", NULL);
+		free_percpu(shards);
+		kmem_cache_destroy(item_cache);
+		return ret;
+	}
+
+	/* el benchmark es opcional: si no hay debugfs el modulo funciona igual */
+	bench_dir = debugfs_create_dir("modlist", NULL);
+	if (!IS_ERR_OR_NULL(bench_dir))
+		debugfs_create_file("bench", 0600, bench_dir, NULL, &bench_fops);
+
+	printk(KERN_INFO "Modlist: Module loaded\n");
 	return ret;
 }
 
 
 void exit_modlist_module( void )
 {
-	modlist_cleanup();
+	debugfs_remove_recursive(bench_dir);
 	remove_proc_entry("modlist", NULL); // eliminar la entrada del /proc
+	modlist_chardev_exit();
+	modlist_cleanup(); // ya no puede llegar ningun add: la cache queda vacia
+	rcu_barrier(); // esperar a las liberaciones pendientes
+	free_percpu(shards);
+	kmem_cache_destroy(item_cache);
 	printk(KERN_INFO "Modlist: Module unloaded.\n");
 }
 
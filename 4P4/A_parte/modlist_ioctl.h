@@ -0,0 +1,32 @@
+#ifndef MODLIST_IOCTL_H
+#define MODLIST_IOCTL_H
+
+/*
+ * Interfaz binaria de modlist (/dev/modlist), compartida por el modulo y los
+ * programas de usuario. Los datos viajan como arrays de int32 empaquetados,
+ * sin pasar por sscanf/sprintf. Ademas de los ioctl, un write() de un array
+ * de int32 sobre /dev/modlist equivale a MODLIST_IOC_ADD_BULK.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define MODLIST_DEVICE_NAME	"modlist"
+
+struct modlist_array {
+	__u64 data;		// direccion de un array de __s32 en espacio de usuario
+	__u32 count;	// enteros que caben en / hay en data
+	__u32 done;		// salida: enteros añadidos o copiados
+	__u32 total;	// salida: elementos en la lista tras la operacion
+	__u32 pad;
+};
+
+#define MODLIST_IOC_MAGIC	'm'
+
+#define MODLIST_IOC_ADD			_IOW(MODLIST_IOC_MAGIC, 1, __s32)
+#define MODLIST_IOC_REMOVE		_IOW(MODLIST_IOC_MAGIC, 2, __s32)
+#define MODLIST_IOC_ADD_BULK	_IOWR(MODLIST_IOC_MAGIC, 3, struct modlist_array)
+#define MODLIST_IOC_DUMP		_IOWR(MODLIST_IOC_MAGIC, 4, struct modlist_array)
+#define MODLIST_IOC_CLEANUP		_IO(MODLIST_IOC_MAGIC, 5)
+
+#endif
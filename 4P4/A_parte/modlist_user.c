@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include "modlist_ioctl.h"
+
+/*
+ * Cliente de /dev/modlist. Compilar con: gcc -Wall -o modlist_user modlist_user.c
+ *  ./modlist_user load < numeros.txt  --> empaqueta los enteros y los añade con un ioctl
+ *  ./modlist_user dump                --> vuelca la lista como texto
+ */
+
+#define CHUNK 65536
+
+const char *file = "/dev/" MODLIST_DEVICE_NAME;
+
+static int load(int fd){
+	struct modlist_array arr = { 0 };
+	int *nums = malloc(CHUNK * sizeof(int));
+	unsigned long total = 0;
+	int n = 0;
+
+	if (!nums){
+		perror("malloc");
+		return -1;
+	}
+	while (1){
+		int end = (scanf("%d", &nums[n]) != 1);
+		if (!end)
+			n++;
+		if (n == CHUNK || (end && n > 0)){
+			arr.data = (unsigned long)nums;
+			arr.count = n;
+			if (ioctl(fd, MODLIST_IOC_ADD_BULK, &arr) < 0){
+				perror("MODLIST_IOC_ADD_BULK");
+				free(nums);
+				return -1;
+			}
+			total += arr.done;
+			n = 0;
+		}
+		if (end)
+			break;
+	}
+	printf("%lu added, %u in list\n", total, arr.total);
+	free(nums);
+	return 0;
+}
+
+static int dump(int fd){
+	struct modlist_array arr;
+	int *nums = NULL;
+	unsigned int i, size = CHUNK;
+
+	/* si la lista no cabe se repite con un array mas grande */
+	do {
+		free(nums);
+		nums = malloc(size * sizeof(int));
+		if (!nums){
+			perror("malloc");
+			return -1;
+		}
+		arr.data = (unsigned long)nums;
+		arr.count = size;
+		if (ioctl(fd, MODLIST_IOC_DUMP, &arr) < 0){
+			perror("MODLIST_IOC_DUMP");
+			free(nums);
+			return -1;
+		}
+		size = arr.total * 2;
+	} while (arr.done < arr.total && arr.done == arr.count);
+
+	for (i = 0; i < arr.done; i++)
+		printf("%d\n", nums[i]);
+	free(nums);
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	int ret, fd;
+
+	if (argc != 2 || (strcmp(argv[1], "load") && strcmp(argv[1], "dump"))){
+		printf("Usage: %s load|dump\n", argv[0]);
+		return -1;
+	}
+	fd = open(file, O_RDWR);
+	if (fd < 0){
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+	if (strcmp(argv[1], "load") == 0)
+		ret = load(fd);
+	else
+		ret = dump(fd);
+	close(fd);
+	return ret;
+}
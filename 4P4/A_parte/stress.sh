@@ -0,0 +1,46 @@
+#!/bin/bash
+# Uso: ./stress.sh [lectores] [escritores] [segundos] [elementos iniciales]
+# Lanza N lectores (cat) y M escritores (add/remove) a la vez contra
+# /proc/modlist y muestra lecturas y escrituras por segundo. Para comparar,
+# ejecutarlo con el modulo anterior cargado y despues con el actual.
+
+READERS=${1:-4}
+WRITERS=${2:-4}
+SECS=${3:-10}
+PRELOAD=${4:-100000}
+TMP=$(mktemp -d)
+
+lector() {
+	local n=0
+	local end=$((SECONDS + SECS))
+	while [ $SECONDS -lt $end ]; do
+		cat /proc/modlist > /dev/null
+		n=$((n+1))
+	done
+	echo $n > $TMP/lector$1
+}
+
+escritor() {
+	local n=0
+	local end=$((SECONDS + SECS))
+	while [ $SECONDS -lt $end ]; do
+		echo add $((n + $1 * 1000000)) > /proc/modlist
+		echo remove $((n + $1 * 1000000)) > /proc/modlist
+		n=$((n+1))
+	done
+	echo $((2 * n)) > $TMP/escritor$1
+}
+
+echo cleanup > /proc/modlist
+seq -f "add %.0f" 1 $PRELOAD > /proc/modlist
+
+for ((i=0; $i<$READERS; i++)); do lector $i & done
+for ((i=0; $i<$WRITERS; i++)); do escritor $i & done
+wait
+
+echo "$READERS lectores, $WRITERS escritores, $PRELOAD elementos, $SECS s"
+cat $TMP/lector* | awk -v s=$SECS '{ t += $1 } END { printf "lecturas (cat completos)/s: %.1f\n", t / s }'
+cat $TMP/escritor* | awk -v s=$SECS '{ t += $1 } END { printf "escrituras (add/remove)/s: %.1f\n", t / s }'
+
+echo cleanup > /proc/modlist
+rm -rf $TMP
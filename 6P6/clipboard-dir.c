@@ -3,7 +3,17 @@
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/semaphore.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/seq_file.h>
+#include <linux/moduleparam.h>
+
+#include "clipboard_mmap.h"
 
 
 
@@ -11,14 +21,86 @@ MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Clipboard Kernel Module - FDI-UCM");
 
 #define BUFFER_LENGTH       PAGE_SIZE
+#define COMMANDS_LENGTH     100
+#define TEMP_LENGTH         16
+#define N_SIZE              16      /* Max length of a slot name, '\0' included */
+#define SLOT_HASH_BITS      6
+#define HISTORY_SLOT        "clipboard"
+#define HISTORY_NAME        "clipboard_history"
+
+static unsigned int max_slots = 64;
+static unsigned int history_depth = 8;
+
+module_param(max_slots, uint, 0444);
+MODULE_PARM_DESC(max_slots, "Maximum number of clipboards under /proc/test");
+module_param(history_depth, uint, 0444);
+MODULE_PARM_DESC(history_depth, "Versions of /proc/test/clipboard kept in /proc/test/clipboard_history (0 disables it)");
+
+/*
+ * Last history_depth versions of a slot, in a ring inside an arena that is
+ * allocated with the slot: a write copies the user data straight into the
+ * next entry and publishes it from there, so it never allocates.
+ */
+struct clipboard_history {
+    char *arena;                // history_depth buffers of BUFFER_LENGTH bytes
+    unsigned int *len;
+    u32 *gen;                   // Generation (shm->seq / 2) of each version
+    unsigned int head;          // Entry the next write goes to
+    unsigned int count;         // Versions stored
+    struct proc_dir_entry *entry;
+};
+
+/*
+ * Every clipboard is a slot with its own buffer, lock and stats, and its own
+ * entry /proc/test/<name>. Slots are created and deleted through
+ * /proc/test/admin ("new <name>", "delete <name>") and found by name in
+ * slot_hash. /proc/test/clipboard is created at load time.
+ */
+struct clipboard_slot {
+    char name[N_SIZE];
+    struct hlist_node hash;
+    struct proc_dir_entry *entry;
+    void *area;                 // Header page + data page, mappable by user programs
+    struct clipboard_shm *shm;  // First page of area
+    char *data;                 // Second page of area
+    struct mutex mtx;           /* Serializes writers and history readers, readers rely on shm->seq */
+    char *stage;                // Preallocated copy of the user data (slots without history)
+    struct clipboard_history *history;
+    atomic64_t nr_reads;
+    atomic64_t nr_writes;
+    atomic64_t bytes_written;
+};
+
+static DEFINE_HASHTABLE(slot_hash, SLOT_HASH_BITS);
+static struct semaphore slots_sem;  /* Protects slot_hash and nr_slots */
+static unsigned int nr_slots = 0;
 
-static struct proc_dir_entry *proc_entry;
-static char *clipboard;  // Space for the "clipboard"
 struct proc_dir_entry *test_dir=NULL;
+static struct proc_dir_entry *admin_entry;
+
+static u32 slot_key(const char *name)
+{
+    return jhash(name, strlen(name), 0);
+}
+
+/* Call with slots_sem held */
+static struct clipboard_slot *slot_lookup(const char *name)
+{
+    struct clipboard_slot *slot;
+
+    hash_for_each_possible(slot_hash, slot, hash, slot_key(name))
+        if (strcmp(slot->name, name) == 0)
+            return slot;
+    return NULL;
+}
 
 static ssize_t clipboard_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
 {
+    struct clipboard_slot *slot = PDE_DATA(file_inode(filp));
+    struct clipboard_history *history = slot->history;
+    struct clipboard_shm *shm = slot->shm;
     int available_space = BUFFER_LENGTH-1;
+    char *kbuf;
 
     if ((*off) > 0) /* The application can write in this entry just once !! */
         return 0;
@@ -28,72 +110,404 @@ static ssize_t clipboard_write(struct file *filp, const char __user *buf, size_t
         return -ENOSPC;
     }
 
-    /* Transfer data from user to kernel space */
-    if (copy_from_user( &clipboard[0], buf, len ))
+    mutex_lock(&slot->mtx);
+    kbuf = history ? history->arena + history->head * BUFFER_LENGTH : slot->stage;
+    if (history && history->count == history_depth) {
+        /* The head entry is the oldest version kept: drop it before copying over it */
+        history->count--;
+        history->len[history->head] = 0;
+    }
+
+    /* Transfer data from user to kernel space, outside the write section */
+    if (copy_from_user( kbuf, buf, len )) {
+        mutex_unlock(&slot->mtx);
         return -EFAULT;
+    }
+
+    preempt_disable();  /* Readers spin while seq is odd */
+    WRITE_ONCE(shm->seq, shm->seq + 1);  /* Odd: write in progress */
+    smp_wmb();
+    memcpy(slot->data, kbuf, len);
+    slot->data[len] = '\0'; /* Add the `\0' */
+    WRITE_ONCE(shm->len, len);
+    smp_wmb();
+    WRITE_ONCE(shm->seq, shm->seq + 1);  /* Even again: new contents published */
+    preempt_enable();
+
+    if (history) {
+        history->len[history->head] = len;
+        history->gen[history->head] = shm->seq / 2;
+        history->head = (history->head + 1) % history_depth;
+        history->count = min(history->count + 1, history_depth);
+    }
+    mutex_unlock(&slot->mtx);
 
-    clipboard[len] = '\0'; /* Add the `\0' */
+    atomic64_inc(&slot->nr_writes);
+    atomic64_add(len, &slot->bytes_written);
     *off+=len;            /* Update the file pointer */
 
     return len;
 }
 
+/* Readers never take the slot lock: they copy and retry if a write got in */
 static ssize_t clipboard_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
 {
-
+    struct clipboard_slot *slot = PDE_DATA(file_inode(filp));
+    struct clipboard_shm *shm = slot->shm;
+    unsigned int seq;
     int nr_bytes;
+    char *kbuf;
 
     if ((*off) > 0) /* Tell the application that there is nothing left to read */
         return 0;
 
-    nr_bytes=strlen(clipboard);
+    kbuf = kmalloc(BUFFER_LENGTH, GFP_KERNEL);
+    if (!kbuf)
+        return -ENOMEM;
 
-    if (len<nr_bytes)
+    do {
+        while ((seq = READ_ONCE(shm->seq)) & 1)
+            cpu_relax();
+        smp_rmb();
+        nr_bytes = READ_ONCE(shm->len);
+        memcpy(kbuf, slot->data, nr_bytes);
+        smp_rmb();
+    } while (READ_ONCE(shm->seq) != seq);
+
+    if (len<nr_bytes) {
+        kfree(kbuf);
         return -ENOSPC;
+    }
 
     /* Transfer data from the kernel to userspace */
-    if (copy_to_user(buf, clipboard,nr_bytes))
+    if (copy_to_user(buf, kbuf, nr_bytes)) {
+        kfree(kbuf);
         return -EINVAL;
+    }
+    kfree(kbuf);
 
+    atomic64_inc(&slot->nr_reads);
     (*off)+=len;  /* Update the file pointer */
 
     return nr_bytes;
 }
 
+/* Read-only mapping of the header and data pages (see clipboard_mmap.h) */
+static int clipboard_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct clipboard_slot *slot = PDE_DATA(file_inode(filp));
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_vmalloc_range(vma, slot->area, vma->vm_pgoff);
+}
+
 static const struct file_operations proc_entry_fops = {
     .read = clipboard_read,
     .write = clipboard_write,
+    .mmap = clipboard_mmap,
+};
+
+/*
+ * /proc/test/clipboard_history: cat lists every stored version, newest
+ * first. Writing an index on the same descriptor selects one version and
+ * the following reads return only its contents, 0 being the current one
+ * and -1 the one before: exec 3<>clipboard_history; echo -3 >&3; cat <&3
+ * Writing "all" goes back to the list.
+ */
+struct history_reader {
+    struct clipboard_slot *slot;
+    bool one;
+    int index;
 };
 
+static int history_show(struct seq_file *m, void *v)
+{
+    struct history_reader *reader = m->private;
+    struct clipboard_history *history = reader->slot->history;
+    unsigned int k, i;
+    char *data;
+
+    mutex_lock(&reader->slot->mtx);
+    if (reader->one) {
+        /* O(1): the k-th newest version is k entries behind head */
+        if (-reader->index < (int)history->count) {
+            i = (history->head + history_depth - 1 + reader->index) % history_depth;
+            seq_write(m, history->arena + i * BUFFER_LENGTH, history->len[i]);
+        }
+        mutex_unlock(&reader->slot->mtx);
+        return 0;
+    }
+    for (k = 0; k < history->count; k++) {
+        i = (history->head + history_depth - 1 - k) % history_depth;
+        data = history->arena + i * BUFFER_LENGTH;
+        seq_printf(m, "[-%u] generation %u, %u bytes\n", k, history->gen[i], history->len[i]);
+        seq_write(m, data, history->len[i]);
+        if (history->len[i] && data[history->len[i] - 1] != '\n')
+            seq_putc(m, '\n');
+    }
+    mutex_unlock(&reader->slot->mtx);
+    return 0;
+}
+
+static ssize_t history_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+{
+    struct seq_file *m = filp->private_data;
+    struct history_reader *reader = m->private;
+    char kbuf[TEMP_LENGTH];
+    bool one = true;
+    int index = 0;
 
+    if (len > TEMP_LENGTH-1)
+        return -EINVAL;
+    if (copy_from_user( kbuf, buf, len ))
+        return -EFAULT;
+    kbuf[len] = '\0';
 
-int init_clipboard_module( void )
+    if (strcmp(strim(kbuf), "all") == 0)
+        one = false;
+    else if (kstrtoint(strim(kbuf), 10, &index) || index > 0 || -index >= (int)history_depth)
+        return -EINVAL;
+
+    mutex_lock(&m->lock);
+    reader->one = one;
+    reader->index = index;
+    mutex_unlock(&m->lock);
+    *off = 0;  /* The next read starts over with the new selection */
+    return len;
+}
+
+static int history_open(struct inode *inode, struct file *filp)
+{
+    struct history_reader *reader = kzalloc(sizeof(struct history_reader), GFP_KERNEL);
+    int ret;
+
+    if (!reader)
+        return -ENOMEM;
+    reader->slot = PDE_DATA(inode);
+    ret = single_open(filp, history_show, reader);
+    if (ret)
+        kfree(reader);
+    return ret;
+}
+
+static int history_release(struct inode *inode, struct file *filp)
 {
-    clipboard = (char *)vmalloc( BUFFER_LENGTH );
+    kfree(((struct seq_file *)filp->private_data)->private);
+    return single_release(inode, filp);
+}
+
+static const struct file_operations history_fops = {
+    .open = history_open,
+    .read = seq_read,
+    .write = history_write,
+    .llseek = seq_lseek,
+    .release = history_release,
+};
+
+static void history_free(struct clipboard_history *history)
+{
+    if (!history)
+        return;
+    vfree(history->arena);
+    kfree(history->len);
+    kfree(history->gen);
+    kfree(history);
+}
 
-    if (!clipboard) {
-        return  -ENOMEM;
+static struct clipboard_history *history_alloc(void)
+{
+    struct clipboard_history *history = kzalloc(sizeof(struct clipboard_history), GFP_KERNEL);
+
+    if (!history)
+        return NULL;
+    history->arena = vmalloc(history_depth * BUFFER_LENGTH);
+    history->len = kcalloc(history_depth, sizeof(unsigned int), GFP_KERNEL);
+    history->gen = kcalloc(history_depth, sizeof(u32), GFP_KERNEL);
+    if (!history->arena || !history->len || !history->gen) {
+        history_free(history);
+        return NULL;
+    }
+    return history;
+}
+
+/* Call with slots_sem held */
+static int slot_create(const char *name)
+{
+    struct clipboard_slot *slot;
+
+    if (strlen(name) >= N_SIZE || strcmp(name, "admin") == 0 || strcmp(name, HISTORY_NAME) == 0)
+        return -EINVAL;
+    if (slot_lookup(name))
+        return -EEXIST;
+    if (nr_slots == max_slots)
+        return -ENOSPC;
+
+    slot = kzalloc(sizeof(struct clipboard_slot), GFP_KERNEL);
+    if (!slot)
+        return -ENOMEM;
+    /* vmalloc_user: zeroed and allowed in remap_vmalloc_range() */
+    slot->area = vmalloc_user( PAGE_SIZE + BUFFER_LENGTH );
+    if (!slot->area) {
+        kfree(slot);
+        return -ENOMEM;
+    }
+    slot->shm = slot->area;
+    slot->data = (char *)slot->area + PAGE_SIZE;
+    strcpy(slot->name, name);
+    mutex_init(&slot->mtx);
+
+    if (history_depth && strcmp(name, HISTORY_SLOT) == 0)
+        slot->history = history_alloc();
+    else
+        slot->stage = kmalloc(BUFFER_LENGTH, GFP_KERNEL);
+    if (!slot->history && !slot->stage)
+        goto nomem;
+
+    if (slot->history) {
+        slot->history->entry = proc_create_data(HISTORY_NAME, 0666, test_dir, &history_fops, slot);
+        if (!slot->history->entry)
+            goto nomem;
+    }
+
+    slot->entry = proc_create_data(slot->name, 0666, test_dir, &proc_entry_fops, slot);
+    if (!slot->entry) {
+        if (slot->history)
+            remove_proc_entry(HISTORY_NAME, test_dir);
+        goto nomem;
     }
+    hash_add(slot_hash, &slot->hash, slot_key(slot->name));
+    nr_slots++;
+    return 0;
+
+nomem:
+    history_free(slot->history);
+    kfree(slot->stage);
+    vfree(slot->area);
+    kfree(slot);
+    return -ENOMEM;
+}
+
+/* Call with slots_sem held */
+static void slot_destroy(struct clipboard_slot *slot)
+{
+    hash_del(&slot->hash);
+    nr_slots--;
+    /* Waits for reads and writes in progress; mappings keep their own page references */
+    remove_proc_entry(slot->name, test_dir);
+    if (slot->history)
+        remove_proc_entry(HISTORY_NAME, test_dir);
+    history_free(slot->history);
+    kfree(slot->stage);
+    vfree(slot->area);
+    kfree(slot);
+}
+
+static ssize_t admin_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+{
+    char command_buf[COMMANDS_LENGTH];
+    char name[COMMANDS_LENGTH];
+    struct clipboard_slot *slot;
+    int ret = 0;
 
-    memset( clipboard, 0, BUFFER_LENGTH );
+    if (len > COMMANDS_LENGTH-1) {
+        printk(KERN_INFO "clipboard: command not enough space!!\n");
+        return -ENOSPC;
+    }
+
+    /* Transfer data from user to kernel space */
+    if (copy_from_user( command_buf, buf, len ))
+        return -EFAULT;
+    command_buf[len] = '\0'; /* Add the `\0' */
+
+    if (down_interruptible(&slots_sem))
+        return -EINTR;
+
+    if (sscanf(command_buf, "new %s", name) == 1)
+        ret = slot_create(name);
+    else if (sscanf(command_buf, "delete %s", name) == 1) {
+        slot = slot_lookup(name);
+        if (slot)
+            slot_destroy(slot);
+        else
+            ret = -ENOENT;
+    }
+    else {
+        printk(KERN_INFO "clipboard: invalid command\n");
+        ret = -EINVAL;
+    }
+    up(&slots_sem);
+
+    if (ret)
+        return ret;
+    *off+=len;            /* Update the file pointer */
+    return len;
+}
+
+/* Reading admin lists every slot with its stats */
+static int admin_show(struct seq_file *m, void *v)
+{
+    struct clipboard_slot *slot;
+    int bkt;
+
+    if (down_interruptible(&slots_sem))
+        return -EINTR;
+    seq_printf(m, "%-16s %8s %12s %12s %14s\n", "name", "size", "reads", "writes", "bytes_written");
+    hash_for_each(slot_hash, bkt, slot, hash)
+        seq_printf(m, "%-16s %8u %12lld %12lld %14lld\n", slot->name, READ_ONCE(slot->shm->len),
+                   (long long)atomic64_read(&slot->nr_reads), (long long)atomic64_read(&slot->nr_writes),
+                   (long long)atomic64_read(&slot->bytes_written));
+    up(&slots_sem);
+    return 0;
+}
+
+static int admin_open(struct inode *inode, struct file *filp)
+{
+    return single_open(filp, admin_show, NULL);
+}
+
+static const struct file_operations admin_fops = {
+    .open = admin_open,
+    .read = seq_read,
+    .write = admin_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+
+
+int init_clipboard_module( void )
+{
+    int ret;
+
+    sema_init(&slots_sem, 1);
 
     /* Create proc directory */
     test_dir=proc_mkdir("test",NULL);
 
     if (!test_dir) {
-        vfree(clipboard);
         return -ENOMEM;
     }
 
-    /* Create proc entry /proc/test/clipboard */
-    proc_entry = proc_create( "clipboard", 0666, test_dir, &proc_entry_fops);
+    /* Create proc entry /proc/test/admin */
+    admin_entry = proc_create( "admin", 0666, test_dir, &admin_fops);
 
-    if (proc_entry == NULL) {
+    if (admin_entry == NULL) {
         remove_proc_entry("test", NULL);
-        vfree(clipboard);
         return -ENOMEM;
     }
 
+    /* Create proc entry /proc/test/clipboard */
+    ret = slot_create("clipboard");
+
+    if (ret) {
+        remove_proc_entry("admin", test_dir);
+        remove_proc_entry("test", NULL);
+        return ret;
+    }
+
     if(1)
         printk(KERN_INFO "Clipboard: Module loaded\n");
     if(!0)
@@ -104,9 +518,14 @@ int init_clipboard_module( void )
 
 void exit_clipboard_module( void )
 {
-    remove_proc_entry("clipboard", test_dir);
+    struct clipboard_slot *slot;
+    struct hlist_node *tmp;
+    int bkt;
+
+    remove_proc_entry("admin", test_dir);
+    hash_for_each_safe(slot_hash, bkt, tmp, slot, hash)
+        slot_destroy(slot);
     remove_proc_entry("test", NULL);
-    vfree(clipboard);
     printk(KERN_INFO "Clipboard: Module removed.\n");
 }
 
@@ -0,0 +1,24 @@
+#ifndef CLIPBOARD_MMAP_H
+#define CLIPBOARD_MMAP_H
+
+/*
+ * Layout of an mmap() of /proc/test/clipboard, or of any other slot under
+ * /proc/test (read-only, MAP_SHARED). Shared by the module and user programs.
+ *
+ *   page 0: struct clipboard_shm
+ *   page 1: clipboard contents, clipboard_shm.len bytes plus a '\0'
+ *
+ * seq is odd while a write is in progress. To take a consistent snapshot,
+ * read seq (retry while odd), copy len bytes from the data page, and retry
+ * if seq changed meanwhile. Comparing seq with a previous value tells
+ * whether the clipboard changed, without any system call.
+ */
+
+#include <linux/types.h>
+
+struct clipboard_shm {
+    __u32 seq;   /* incremented twice by every write */
+    __u32 len;   /* bytes in the data page */
+};
+
+#endif
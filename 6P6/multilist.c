@@ -3,6 +3,7 @@
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/ftrace.h>
 #include <linux/list.h>
@@ -10,15 +11,65 @@
 #include <linux/init.h>
 #include <linux/stat.h>
 #include <linux/moduleparam.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/rcupdate.h>
+#include <linux/rculist.h>
+#include <linux/seqlock.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <linux/err.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include "multilist_image.h"
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Multilist Kernel Module - FDI-UCM");
 MODULE_AUTHOR("Xukai Chen");
 
 #define MAX_SIZE      		64
-#define TEMP_BUFFER_LENGTH  32
 #define COMMANDS_LENGTH		100	
 #define N_SIZE				16
+#define STATS_LENGTH		192
+#define INTERN_HASH_BITS	10	// 1024 cubetas para las cadenas compartidas
+#define ARENA_ORDER			2	// trozos de 4 paginas para guardar las cadenas
+#define ARENA_ALIGN			8
+#define LIST_HASH_BITS		8	// 256 cubetas para buscar listas por nombre
+#define INT_TEXT_LENGTH		12	// "-2147483648\n"
+#define INT_BLOCK_SIZE		250	// enteros por bloque: cada bloque ocupa algo menos de 1KB
+#define POOL_SIZE			16	// nodos libres que guarda cada lista para reutilizarlos
+#define LIST_LINE_LENGTH	64	// linea de una lista en la lectura de admin
+#define HIST_BUCKETS		32	// cubeta i: latencias de [2^(i-1), 2^i) ns, la 0 para 0 ns
+#define READ_RETRIES		4	// lecturas sin cerrojo antes de coger mtx
+#define INTERN_BATCH		256	// referencias por cada vez que se coge intern_lock
+
+/* Que hace add con la lista llena: new <nombre> <tipo> [capacidad] [politica] */
+enum overflow_policy {
+	POLICY_REJECT,		// "reject": -ENOSPC, como siempre
+	POLICY_DROP_OLDEST,	// "drop-oldest" o "ring": se descarta el dato mas antiguo
+	POLICY_DROP_NEWEST,	// "drop-newest": se descarta el dato nuevo sin dar error
+};
+
+static const char *policy_names[] = { "reject", "drop-oldest", "drop-newest" };
+
+/*
+ * Contadores de cada lista, uno por CPU para que contar no cueste un cerrojo
+ * ni una linea de cache compartida. /proc/multilist/stats los suma.
+ */
+enum list_op { OP_ADD, OP_REMOVE, OP_READ, NR_OPS };
+
+static const char *op_names[] = { "add", "remove", "read" };
+
+struct list_stats {
+	u64 ops[NR_OPS];
+	u64 bytes_out;				// bytes devueltos por read
+	u64 nospc;					// add rechazados con -ENOSPC
+	u64 dropped;				// datos descartados por drop-oldest o drop-newest
+	u64 contended;				// list_lock encontro el cerrojo cogido
+	u64 retries;				// lecturas repetidas porque un escritor cambio la lista
+	u64 hist[NR_OPS][HIST_BUCKETS];	// latencias en log2
+};
 
 /* modules parameters */
 static unsigned int max_entries = 5;
@@ -32,11 +83,18 @@ MODULE_PARM_DESC(max_size, "An unsigned short");
 /* module directory */
 struct proc_dir_entry *multilist=NULL;
 static struct proc_dir_entry *proc_entry_admin; // admin proc 
+static struct proc_dir_entry *proc_entry_stats; // contadores de cada lista
+static struct proc_dir_entry *proc_entry_snapshot; // volcado y carga de todas las listas
 static struct semaphore multilist_sem; 				
 static int terminado = 0;
 
-/* seccion critica de admin */
+/*
+ * seccion critica de admin: list_entry guarda el orden de creacion y list_hash
+ * indexa por nombre. Se modifican con multilist_sem cogido y se recorren bajo
+ * RCU, asi que la lectura de admin no espera a nadie.
+ */
 struct list_head list_entry; // nodo fantasma
+static DEFINE_HASHTABLE(list_hash, LIST_HASH_BITS);
 static int entries = 0;
 
 struct list_elem {
@@ -44,20 +102,520 @@ struct list_elem {
 	int data_type;
 	unsigned int num_elem;
 	struct list_head data_list;
-	spinlock_t mtx;
+	spinlock_t mtx;					// escritores de la lista
+	seqcount_t seq;					// los lectores repiten si cambia (ver modlist_read)
 	struct list_head links;
+	struct hlist_node hash;
+	unsigned int capacity;			// 0: max_size
+	enum overflow_policy policy;
+	struct list_head pool;			// nodos descartados, listos para el proximo add
+	unsigned int nr_pool;
+	spinlock_t pool_lock;			// la reserva tambien se rellena desde callbacks de RCU
+	struct list_stats __percpu *stats;
 };
 
-struct list_item_int {
-	int data;
+static unsigned int list_capacity(struct list_elem *elem){
+	return elem->capacity ? elem->capacity : max_size;
+}
+
+static int setup_list_elem(struct list_elem *elem, const char *name, int type,
+		unsigned int capacity, enum overflow_policy policy){
+	elem->stats = alloc_percpu(struct list_stats);
+	if (!elem->stats)
+		return -ENOMEM;
+	strcpy(elem->name, name);
+	elem->data_type = type;
+	elem->num_elem = 0;
+	spin_lock_init(&(elem->mtx));
+	seqcount_init(&(elem->seq));
+	INIT_LIST_HEAD(&(elem->data_list));
+	elem->capacity = capacity;
+	elem->policy = policy;
+	INIT_LIST_HEAD(&(elem->pool));
+	elem->nr_pool = 0;
+	spin_lock_init(&(elem->pool_lock));
+	return 0;
+}
+
+static void account_op(struct list_elem *elem, enum list_op op, u64 start){
+	u64 ns = ktime_get_ns() - start;
+
+	this_cpu_inc(elem->stats->ops[op]);
+	this_cpu_inc(elem->stats->hist[op][min_t(unsigned int, fls64(ns), HIST_BUCKETS - 1)]);
+}
+
+static u32 list_key(const char *name){
+	return jhash(name, strlen(name), 0);
+}
+
+/* Busca una lista por nombre, con multilist_sem cogido */
+static struct list_elem *find_list(const char *name){
+	struct list_elem *elem;
+
+	hash_for_each_possible(list_hash, elem, hash, list_key(name))
+		if (strcmp(elem->name, name) == 0)
+			return elem;
+	return NULL;
+}
+
+/* Da de alta una lista en list_entry y list_hash, con multilist_sem cogido */
+static void link_list(struct list_elem *elem){
+	list_add_tail_rcu(&(elem->links), &list_entry);
+	hash_add_rcu(list_hash, &(elem->hash), list_key(elem->name));
+}
+
+/* Quien la quite debe esperar a los lectores (synchronize_rcu) antes de liberarla */
+static void unlink_list(struct list_elem *elem){
+	list_del_rcu(&(elem->links));
+	hash_del_rcu(&(elem->hash));
+}
+
+/*
+ * Las listas de enteros guardan los datos en bloques de INT_BLOCK_SIZE
+ * enteros contiguos, en orden, en vez de un nodo por entero. Solo se
+ * escribe en el ultimo bloque; remove compacta cada bloque y libera los
+ * que se quedan vacios.
+ */
+struct int_block {
 	struct list_head links;
+	unsigned int first;			// data[first..count) estan en uso: drop-oldest avanza first
+	unsigned int count;
+	int data[INT_BLOCK_SIZE];
 };
 
+/*
+ * Antes las cadenas cortas iban dentro del nodo (inline_data); con las
+ * cadenas compartidas el nodo solo guarda el puntero, que es lo que
+ * compara remove, y las repetidas no ocupan mas.
+ */
 struct list_item_char {
-	char *data;
+	const char *data;	// cadena compartida (intern_get), NULL en la reserva
 	struct list_head links;
 };
 
+/*
+ * Cadenas compartidas: cada cadena distinta se guarda una sola vez para
+ * todo el modulo, con un contador de los nodos que la usan, y dos nodos
+ * con la misma cadena tienen el mismo puntero. Se sacan de trozos grandes
+ * (arena) avanzando un puntero; las que dejan de usarse quedan en
+ * intern_free, por tamaño, para la siguiente cadena de ese tamaño. Los
+ * trozos solo se devuelven al descargar el modulo.
+ *
+ * refs solo baja despues de un periodo de gracia (ver reclaim_items), asi
+ * que un lector sin cerrojos nunca ve una cadena reutilizada.
+ */
+struct intern_str {
+	struct hlist_node hnode;	// en intern_hash o, si refs == 0, en intern_free
+	u32 hash;
+	unsigned int refs;
+	unsigned char class;		// ocupa class * ARENA_ALIGN bytes
+	char data[];
+};
+
+struct arena_chunk {
+	struct arena_chunk *next;
+};
+
+#define INTERN_CLASS(len)	DIV_ROUND_UP(sizeof(struct intern_str) + (len) + 1, ARENA_ALIGN)
+#define ARENA_START			ALIGN(sizeof(struct arena_chunk), ARENA_ALIGN)
+
+static DEFINE_SPINLOCK(intern_lock);	// _bh: reclaim_rcu suelta cadenas
+static DEFINE_HASHTABLE(intern_hash, INTERN_HASH_BITS);
+static struct hlist_head intern_free[INTERN_CLASS(MAX_SIZE - 1) + 1];
+static struct arena_chunk *arena_chunks;
+static char *arena_cur, *arena_end;		// hueco libre del ultimo trozo
+static unsigned int nr_strings, nr_chunks;
+
+/* Caches de nodos: un objeto de slab por bloque de enteros o por cadena en vez de una pagina de vmalloc */
+static struct kmem_cache *int_cache;
+static struct kmem_cache *char_cache;
+static atomic_t nr_int_items = ATOMIC_INIT(0);
+static atomic_t nr_int_blocks = ATOMIC_INIT(0);
+static atomic_t nr_char_items = ATOMIC_INIT(0);
+
+static struct int_block *alloc_int_block(void){
+	struct int_block *block = kmem_cache_alloc(int_cache, GFP_KERNEL);
+	if (!block)
+		return NULL;
+	block->first = block->count = 0;
+	atomic_inc(&nr_int_blocks);
+	return block;
+}
+
+static void free_int_block(struct int_block *block){
+	atomic_sub(block->count - block->first, &nr_int_items);
+	kmem_cache_free(int_cache, block);
+	atomic_dec(&nr_int_blocks);
+}
+
+/* Con intern_lock cogido */
+static struct intern_str *intern_lookup(const char *str, u32 hash){
+	struct intern_str *s;
+
+	hash_for_each_possible(intern_hash, s, hnode, hash)
+		if (s->hash == hash && strcmp(s->data, str) == 0)
+			return s;
+	return NULL;
+}
+
+/* Con intern_lock cogido: hueco para len caracteres, NULL si hace falta otro trozo */
+static struct intern_str *arena_alloc(size_t len){
+	unsigned int class = INTERN_CLASS(len);
+	struct intern_str *s;
+
+	if (!hlist_empty(&intern_free[class])){
+		s = hlist_entry(intern_free[class].first, struct intern_str, hnode);
+		hlist_del(&(s->hnode));
+		return s;
+	}
+	if (arena_end - arena_cur < class * ARENA_ALIGN)
+		return NULL;
+	s = (struct intern_str *)arena_cur;
+	arena_cur += class * ARENA_ALIGN;
+	s->class = class;
+	return s;
+}
+
+/* Con intern_lock cogido. Lo que quedaba del trozo anterior se pierde */
+static void arena_add_chunk(struct arena_chunk *chunk){
+	chunk->next = arena_chunks;
+	arena_chunks = chunk;
+	arena_cur = (char *)chunk + ARENA_START;
+	arena_end = (char *)chunk + (PAGE_SIZE << ARENA_ORDER);
+	nr_chunks++;
+}
+
+/*
+ * Devuelve la copia compartida de str con una referencia mas, creandola si
+ * no existe. El trozo nuevo, si hace falta, se pide sin el cerrojo.
+ */
+static const char *intern_get(const char *str){
+	size_t len = strlen(str);
+	u32 hash = jhash(str, len, 0);
+	struct arena_chunk *chunk = NULL;
+	struct intern_str *s;
+
+	for (;;){
+		spin_lock_bh(&intern_lock);
+		s = intern_lookup(str, hash);
+		if (s)
+			s->refs++;
+		else {
+			s = arena_alloc(len);
+			if (!s && chunk){
+				arena_add_chunk(chunk);
+				chunk = NULL;
+				s = arena_alloc(len);
+			}
+			if (s){
+				s->hash = hash;
+				s->refs = 1;
+				memcpy(s->data, str, len + 1);
+				hash_add(intern_hash, &(s->hnode), hash);
+				nr_strings++;
+			}
+		}
+		spin_unlock_bh(&intern_lock);
+		if (s)
+			break;
+		chunk = (struct arena_chunk *)__get_free_pages(GFP_KERNEL, ARENA_ORDER);
+		if (!chunk)
+			return NULL;
+	}
+	if (chunk)	// otro lo ha añadido antes
+		free_pages((unsigned long)chunk, ARENA_ORDER);
+	return s->data;
+}
+
+/* Como intern_get pero sin crearla: NULL si ningun nodo tiene esa cadena */
+static const char *intern_find(const char *str){
+	u32 hash = jhash(str, strlen(str), 0);
+	struct intern_str *s;
+
+	spin_lock_bh(&intern_lock);
+	s = intern_lookup(str, hash);
+	if (s)
+		s->refs++;
+	spin_unlock_bh(&intern_lock);
+	return s ? s->data : NULL;
+}
+
+static void intern_put(const char *data){
+	struct intern_str *s = container_of(data, struct intern_str, data[0]);
+
+	spin_lock_bh(&intern_lock);
+	if (!--s->refs){
+		hash_del(&(s->hnode));
+		hlist_add_head(&(s->hnode), &intern_free[s->class]);
+		nr_strings--;
+	}
+	spin_unlock_bh(&intern_lock);
+}
+
+/* Al descargar el modulo, cuando ya no queda ningun nodo */
+static void arena_destroy(void){
+	struct arena_chunk *chunk;
+
+	while ((chunk = arena_chunks)){
+		arena_chunks = chunk->next;
+		free_pages((unsigned long)chunk, ARENA_ORDER);
+	}
+}
+
+/* Pone str en un nodo nuevo o sacado de la reserva */
+static int set_item_char(struct list_item_char *item, const char *str){
+	item->data = intern_get(str);
+	return item->data ? 0 : -ENOMEM;
+}
+
+static struct list_item_char *alloc_item_char(const char *str){
+	struct list_item_char *item = kmem_cache_alloc(char_cache, GFP_KERNEL);
+	if (!item)
+		return NULL;
+	if (set_item_char(item, str)){
+		kmem_cache_free(char_cache, item);
+		return NULL;
+	}
+	atomic_inc(&nr_char_items);
+	return item;
+}
+
+static void free_item_char(struct list_item_char *item){
+	if (item->data)
+		intern_put(item->data);
+	kmem_cache_free(char_cache, item);
+	atomic_dec(&nr_char_items);
+}
+
+/* Los escritores de una lista se excluyen con mtx y avisan a los lectores con seq */
+static void list_lock(struct list_elem *elem){
+	if (!spin_trylock(&(elem->mtx))){
+		this_cpu_inc(elem->stats->contended);
+		spin_lock(&(elem->mtx));
+	}
+	write_seqcount_begin(&(elem->seq));
+}
+
+static void list_unlock(struct list_elem *elem){
+	write_seqcount_end(&(elem->seq));
+	spin_unlock(&(elem->mtx));
+}
+
+/*
+ * Lectores (como read_seqbegin_or_lock): los primeros READ_RETRIES intentos
+ * van sin cerrojo; despues se coge mtx, porque con escritores continuos
+ * (un ring drop-oldest, por ejemplo) el lector podria repetir sin fin.
+ */
+static unsigned int read_begin(struct list_elem *elem, int retries){
+	if (retries < READ_RETRIES)
+		return read_seqcount_begin(&(elem->seq));
+	spin_lock(&(elem->mtx));
+	return raw_read_seqcount(&(elem->seq));
+}
+
+/* Termina el intento (soltando mtx si se cogio): 1 si hay que repetirlo */
+static int read_retry(struct list_elem *elem, unsigned int seq, int retries){
+	if (retries < READ_RETRIES)
+		return read_seqcount_retry(&(elem->seq), seq);
+	spin_unlock(&(elem->mtx));
+	return 0;
+}
+
+static void free_node(int type, struct list_head *node){
+	if (type)
+		free_item_char(list_entry(node, struct list_item_char, links));
+	else
+		free_int_block(list_entry(node, struct int_block, links));
+}
+
+/* Libera una lista de nodos que ya nadie puede estar leyendo */
+static void free_items(int type, struct list_head *items){
+	struct list_head *node, *it;
+
+	list_for_each_safe(node, it, items){
+		list_del(node);
+		free_node(type, node);
+	}
+}
+
+/*
+ * Los nodos que salen de una lista se juntan en una lista local (dead) con
+ * el cerrojo cogido. Un lector puede seguir dentro de ellos, asi que no se
+ * liberan hasta despues de un periodo de gracia de RCU: entonces sueltan su
+ * dato y pasan a la reserva de la lista para el siguiente add, o vuelven al
+ * slab si la reserva esta llena.
+ */
+struct reclaim_batch {
+	struct rcu_head rcu;
+	struct list_elem *elem;
+	struct list_head items;
+};
+
+static void reclaim_items(struct list_elem *elem, struct list_head *items){
+	struct list_head *node, *it;
+
+	list_for_each_safe(node, it, items){
+		list_del(node);
+		if (elem->data_type){
+			struct list_item_char *item = list_entry(node, struct list_item_char, links);
+			intern_put(item->data);
+			item->data = NULL;
+		}
+		else {
+			struct int_block *block = list_entry(node, struct int_block, links);
+			atomic_sub(block->count - block->first, &nr_int_items);
+			block->first = block->count = 0;
+		}
+		spin_lock_bh(&(elem->pool_lock));
+		if (elem->nr_pool < POOL_SIZE){
+			list_add(node, &(elem->pool));
+			elem->nr_pool++;
+			node = NULL;
+		}
+		spin_unlock_bh(&(elem->pool_lock));
+		if (node)
+			free_node(elem->data_type, node);
+	}
+}
+
+static void reclaim_rcu(struct rcu_head *rcu){
+	struct reclaim_batch *batch = container_of(rcu, struct reclaim_batch, rcu);
+
+	reclaim_items(batch->elem, &(batch->items));
+	kfree(batch);
+}
+
+/* Entrega dead a RCU, ya sin el cerrojo de la lista */
+static void release_items(struct list_elem *elem, struct list_head *dead){
+	struct reclaim_batch *batch;
+
+	if (list_empty(dead))
+		return;
+	batch = kmalloc(sizeof(struct reclaim_batch), GFP_KERNEL);
+	if (!batch){
+		synchronize_rcu();
+		reclaim_items(elem, dead);
+		return;
+	}
+	batch->elem = elem;
+	INIT_LIST_HEAD(&(batch->items));
+	list_splice(dead, &(batch->items));
+	call_rcu(&(batch->rcu), reclaim_rcu);
+}
+
+static struct list_head *pool_get(struct list_elem *elem){
+	struct list_head *node = NULL;
+
+	spin_lock_bh(&(elem->pool_lock));
+	if (!list_empty(&(elem->pool))){
+		node = elem->pool.next;
+		list_del(node);
+		elem->nr_pool--;
+	}
+	spin_unlock_bh(&(elem->pool_lock));
+	return node;
+}
+
+/*
+ * Lista llena, con el cerrojo cogido: aplica su politica. Devuelve 0 si ha
+ * hecho sitio, 1 si el dato nuevo se descarta y -ENOSPC si se rechaza.
+ */
+static int make_room(struct list_elem *elem, struct list_head *dead){
+	if (elem->policy == POLICY_REJECT || !elem->num_elem)
+		return -ENOSPC;
+	this_cpu_inc(elem->stats->dropped);
+	if (elem->policy == POLICY_DROP_NEWEST)
+		return 1;
+
+	if (elem->data_type){
+		struct list_item_char *item = list_first_entry(&(elem->data_list), struct list_item_char, links);
+		list_move(&(item->links), dead);
+	}
+	else {
+		struct int_block *block = list_first_entry(&(elem->data_list), struct int_block, links);
+		block->first++;
+		atomic_dec(&nr_int_items);
+		if (block->first == block->count)
+			list_move(&(block->links), dead);
+	}
+	elem->num_elem--;
+	return 0;
+}
+
+/*
+ * Añade num al final de una lista de enteros. Si el ultimo bloque esta
+ * lleno se reserva otro fuera del cerrojo y se vuelve a comprobar todo.
+ */
+static int add_int(struct list_elem *elem, int num, struct list_head *dead){
+	struct int_block *block, *spare = NULL;
+	struct list_head *node;
+	int ret = 0;
+
+	list_lock(elem);
+	for (;;){
+		if (elem->num_elem >= list_capacity(elem) && (ret = make_room(elem, dead)))
+			break;
+		block = list_empty(&(elem->data_list)) ? NULL :
+			list_last_entry(&(elem->data_list), struct int_block, links);
+		if (!block || block->count == INT_BLOCK_SIZE){
+			if (!spare && (node = pool_get(elem)))
+				spare = list_entry(node, struct int_block, links);
+			if (!spare){
+				list_unlock(elem);
+				spare = alloc_int_block();
+				if (!spare)
+					return -ENOMEM;
+				list_lock(elem);
+				continue;
+			}
+			list_add_tail(&(spare->links), &(elem->data_list));
+			block = spare;
+			spare = NULL;
+		}
+		block->data[block->count++] = num;
+		elem->num_elem++;
+		atomic_inc(&nr_int_items);
+		break;
+	}
+	list_unlock(elem);
+	if (spare)
+		free_int_block(spare);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Quita todas las apariciones de num, con el cerrojo de la lista cogido.
+ * Cada bloque se compacta sobre si mismo con un bucle sin saltos sobre
+ * memoria contigua; los bloques que se quedan vacios pasan a dead.
+ */
+static void remove_int(struct list_elem *elem, int num, struct list_head *dead){
+	struct int_block *block = NULL;
+	struct int_block *it = NULL;
+	unsigned int i, j;
+
+	list_for_each_entry_safe(block, it, &(elem->data_list), links){
+		for (i = block->first, j = block->first; i < block->count; i++){
+			block->data[j] = block->data[i];
+			j += (block->data[i] != num);
+		}
+		elem->num_elem -= block->count - j;
+		atomic_sub(block->count - j, &nr_int_items);
+		block->count = j;
+		if (j == block->first)
+			list_move(&(block->links), dead);
+	}
+}
+
+static void empty_list(struct list_elem *elem){
+	LIST_HEAD(dead);
+
+	list_lock(elem);
+	list_splice_init(&(elem->data_list), &dead);
+	elem->num_elem = 0;
+	list_unlock(elem);
+	release_items(elem, &dead);
+}
+
 static void multilist_cleanup (void){
 	
 	struct list_elem *elem = NULL;
@@ -67,29 +625,17 @@ static void multilist_cleanup (void){
 		return;
 	}
 
+	/* admin, stats y snapshot ya no existen: nadie mas recorre list_entry */
+	list_for_each_entry(elem, &list_entry, links){
+		remove_proc_entry(elem->name, multilist);	
+		empty_list(elem);
+	}
+	rcu_barrier();	/* los callbacks de reclaim_rcu pendientes usan las listas */
 	list_for_each_entry_safe(elem, it_elem, &list_entry, links){
-		spin_lock(&(elem->mtx));
-		if (elem->data_type){
-			struct list_item_char *item = NULL;
-			struct list_item_char *it = NULL;
-			list_for_each_entry_safe(item, it, &(elem->data_list), links){ // esto recorre las entradas de la lista
-				list_del(&(item->links));
-				vfree(item->data);
-				vfree(item);
-			}
-		}
-		else {
-			struct list_item_int *item = NULL;
-			struct list_item_int *it = NULL;
-			list_for_each_entry_safe(item, it, &(elem->data_list), links){ // esto recorre las entradas de la lista
-				list_del(&(item->links));
-				vfree(item);
-			}
-		}
-		spin_unlock(&(elem->mtx));
-		list_del(&(elem->links));
+		free_items(elem->data_type, &(elem->pool));
+		unlink_list(elem);
+		free_percpu(elem->stats);
 		vfree(elem);
-		remove_proc_entry(elem->name, multilist);	
 	}
 	terminado = 1;
 	up(&multilist_sem);
@@ -107,12 +653,14 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 	int type;
 	unsigned int *num_elem;
 	struct list_head *data_list; 
-	spinlock_t *mtx;
 
 	struct list_item_char *item_char = NULL;
 	struct list_item_char *it_char = NULL;
-	struct list_item_int *item_int = NULL;
-	struct list_item_int *it_int = NULL;
+	const char *str;
+	struct list_head *node;
+	LIST_HEAD(dead);
+	int ret;
+	u64 start;
 
 	struct list_elem *data_cb=(struct list_elem *)PDE_DATA(filp->f_inode);
 	if (data_cb == NULL) {
@@ -121,7 +669,6 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 	type = data_cb->data_type;
 	num_elem = &(data_cb->num_elem);
 	data_list = &(data_cb->data_list);
-	mtx = &(data_cb->mtx);
 	
 	if ((*off) > 0) /* The application can write in this entry just once !! */
 		return 0;
@@ -139,24 +686,16 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 	*off+=len;            /* Update the file pointer */
 	
 	trace_printk("Modlist: Current command: %s", command_buf);
+	start = ktime_get_ns();
 	 
 	if((!type && sscanf(command_buf, "add %d", &num) == 1)) {
-		item_int = (struct list_item_int *) vmalloc(sizeof (struct list_item_int));
-		if (!item_int)
-			return -ENOMEM;
-		item_int->data = num;
-
-		spin_lock(mtx);
-		if (*num_elem == max_size){
-			vfree(item_int);
-			spin_unlock(mtx);
-			return -ENOSPC;
-		}
-		else{
-			list_add_tail(&(item_int->links), data_list);
-			(*num_elem)++;
-		}
-		spin_unlock(mtx);
+		ret = add_int(data_cb, num, &dead);
+		release_items(data_cb, &dead);
+		if (ret == -ENOSPC)
+			this_cpu_inc(data_cb->stats->nospc);
+		if (ret)
+			return ret;
+		account_op(data_cb, OP_ADD, start);
 	}
 	else if(type && (sscanf(command_buf, "add %s", temp) == 1)) {
 		if(strlen(temp) >= MAX_SIZE){
@@ -164,69 +703,59 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 			return -ENOSPC;
 		}
 		 
-		item_char = (struct list_item_char *) vmalloc(sizeof (struct list_item_char));
-		if (!item_char)
-			return -ENOMEM;
-
-		item_char->data = vmalloc(sizeof(char)*strlen(temp)+1);
-		if (!(item_char->data)){
-			vfree(item_char);
-			return -ENOMEM;
+		node = pool_get(data_cb);
+		if (node){
+			item_char = list_entry(node, struct list_item_char, links);
+			if (set_item_char(item_char, temp)){
+				free_item_char(item_char);
+				return -ENOMEM;
+			}
 		}
-		strcpy(item_char->data, temp);
+		else if (!(item_char = alloc_item_char(temp)))
+			return -ENOMEM;
 
-		spin_lock(mtx);
-		if (*num_elem == max_size){
-			vfree(item_char->data);
-			vfree(item_char);
-			spin_unlock(mtx);
-			return -ENOSPC;
-		}
-		else{
+		list_lock(data_cb);
+		ret = (*num_elem >= list_capacity(data_cb)) ? make_room(data_cb, &dead) : 0;
+		if (!ret){
 			list_add_tail(&(item_char->links), data_list);
 			(*num_elem)++;
 		}
-		spin_unlock(mtx);
+		else
+			list_add(&(item_char->links), &dead);
+		list_unlock(data_cb);
+		release_items(data_cb, &dead);
+		if (ret == -ENOSPC)
+			this_cpu_inc(data_cb->stats->nospc);
+		if (ret < 0)
+			return ret;
+		account_op(data_cb, OP_ADD, start);
 	}
 	else if(!type && (sscanf(command_buf, "remove %d", &num) == 1)){
-		spin_lock(mtx);
-		list_for_each_entry_safe(item_int, it_int, data_list, links){
-			if(item_int->data == num){
-				list_del(&(item_int->links));
-				vfree(item_int);
-				(*num_elem)--;
-			}
-		}
-		spin_unlock(mtx);
+		list_lock(data_cb);
+		remove_int(data_cb, num, &dead);
+		list_unlock(data_cb);
+		release_items(data_cb, &dead);
+		account_op(data_cb, OP_REMOVE, start);
 	}
 	else if(type && (sscanf(command_buf, "remove %s", temp) == 1)){
-		spin_lock(mtx);
-		list_for_each_entry_safe(item_char, it_char, data_list, links){
-			if(strcmp(item_char->data, temp) == 0){
-				list_del(&(item_char->links));
-				vfree(item_char->data);
-				vfree(item_char);
-				(*num_elem)--;
+		/* Con la referencia de intern_find la cadena no cambia mientras se compara */
+		str = intern_find(temp);
+		if (str){
+			list_lock(data_cb);
+			list_for_each_entry_safe(item_char, it_char, data_list, links){
+				if(item_char->data == str){
+					list_move(&(item_char->links), &dead);
+					(*num_elem)--;
+				}
 			}
+			list_unlock(data_cb);
+			release_items(data_cb, &dead);
+			intern_put(str);
 		}
-		spin_unlock(mtx);
+		account_op(data_cb, OP_REMOVE, start);
 	}
 	else if(strncmp(command_buf, "cleanup\n", len) == 0){
-		spin_lock(mtx);
-		if (type){
-			list_for_each_entry_safe(item_char, it_char, data_list, links){ // esto recorre las entradas de la lista
-				list_del(&(item_char->links));
-				vfree(item_char->data);
-				vfree(item_char);
-			}
-		} else {
-			list_for_each_entry_safe(item_int, it_int, data_list, links){ // esto recorre las entradas de la lista
-				list_del(&(item_int->links));
-				vfree(item_int);
-			}
-		}
-		*num_elem = 0;
-		spin_unlock(mtx);
+		empty_list(data_cb);
 	}
 	else {
 		printk(KERN_INFO "ERROR: comando inválido.\n");
@@ -235,108 +764,403 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 	return len;
 }
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  
-	/* scope local */
-	int nr_bytes, total_bytes = 0, wt_bytes = 0, to_wt = 0;			// nr_bytes: aux, total_bytes: return value, wt_bytes: bytes to write, to_wt: max bytes can write on buffer 
-	// struct list_item *it, *item = NULL; 							// iterator and temp value
-	char rd_buf[TEMP_BUFFER_LENGTH];								// temp buffer
-	char data_buf[MAX_SIZE];										// aux buffer, number to char 
-	char *ptr_rdbuf = rd_buf, *ptr_buf = buf, *ptr_data = data_buf; // as names indicate
-	
-	/* scope global */
-	int type;
-	struct list_head *data_list;
-	spinlock_t *mtx;
-	
-	struct list_elem *data_cb=(struct list_elem *)PDE_DATA(filp->f_inode);
+/*
+ * Formatea la lista en kbuf sin cerrojos, bajo rcu_read_lock(). Cada
+ * puntero se valida con seq antes de seguirlo: si un escritor ha tocado
+ * la lista se devuelve -EAGAIN y se repite. Los nodos quitados entretanto
+ * siguen existiendo hasta el final del periodo de gracia (ver release_items).
+ */
+static ssize_t format_list(struct list_elem *elem, unsigned int seq, char *kbuf, size_t cap){
+	struct list_head *pos = READ_ONCE(elem->data_list.next);
+	size_t nr_bytes = 0;
+	unsigned int i, count;
+
+	while (pos != &(elem->data_list)){
+		if (read_seqcount_retry(&(elem->seq), seq))
+			return -EAGAIN;
+		if (elem->data_type){
+			struct list_item_char *item = list_entry(pos, struct list_item_char, links);
+			nr_bytes += scnprintf(kbuf + nr_bytes, cap - nr_bytes, "%.*s\n", MAX_SIZE - 1, READ_ONCE(item->data));
+		}
+		else {
+			struct int_block *block = list_entry(pos, struct int_block, links);
+			count = min_t(unsigned int, READ_ONCE(block->count), INT_BLOCK_SIZE);
+			for (i = READ_ONCE(block->first); i < count; i++)
+				nr_bytes += scnprintf(kbuf + nr_bytes, cap - nr_bytes, "%d\n", READ_ONCE(block->data[i]));
+		}
+		pos = READ_ONCE(pos->next);
+	}
+	return nr_bytes;
+}
+
+/*
+ * Lectura de una lista: no coge ningun cerrojo salvo si los escritores
+ * la hacen repetir demasiadas veces (read_begin). Al abrir el fichero se
+ * formatea entera en un buffer, que se guarda en private_data y se sirve
+ * por trozos en cada read, porque copy_to_user puede dormir. El buffer se
+ * reserva fuera de RCU y, si la lista ha crecido, se vuelve a reservar.
+ */
+struct list_text {
+	char *buf;
+	size_t len;
+};
+
+static int modlist_open(struct inode *inode, struct file *filp){
+
+	struct list_text *text;
+	char *kbuf = NULL;
+	size_t cap = 0, need;
+	ssize_t nr_bytes;
+	size_t item_len;
+	unsigned int seq;
+	int retries;
+	u64 start = ktime_get_ns();
+
+	struct list_elem *data_cb=(struct list_elem *)PDE_DATA(inode);
 	if (data_cb == NULL) 
 		return -EINVAL;
-	type = data_cb->data_type;
-	data_list = &(data_cb->data_list);
-	mtx = &(data_cb->mtx);
-	
-	if ((*off) > 0) /* Tell the application that there is nothing left to read */
+	if (!(filp->f_mode & FMODE_READ))
 		return 0;
-	
-	// commit P4 
-	spin_lock(mtx);
-	if (type){
-		struct list_item_char *item = NULL;
-		struct list_item_char *it = NULL;
-		list_for_each_entry_safe(item, it, data_list, links){
-			
-			nr_bytes = ptr_rdbuf - rd_buf;
-			to_wt = TEMP_BUFFER_LENGTH - nr_bytes;
-			
-			if (to_wt < sprintf(ptr_data, "%s\n", item->data)){
-				trace_printk("Modlist: Looping on buffer: %d out %d.\n", nr_bytes, TEMP_BUFFER_LENGTH);
-				do {
-					wt_bytes = snprintf(ptr_rdbuf, to_wt, ptr_data);
-					if (copy_to_user(ptr_buf, rd_buf, TEMP_BUFFER_LENGTH)){
-						spin_unlock(mtx);
-						return -EINVAL;
-					}
-					ptr_buf += TEMP_BUFFER_LENGTH - 1;		
-					ptr_rdbuf = rd_buf;
-					ptr_data += to_wt - 1;
-					total_bytes += TEMP_BUFFER_LENGTH - 1;
-					wt_bytes -= to_wt - 1;
-					to_wt = TEMP_BUFFER_LENGTH;
-				}while (TEMP_BUFFER_LENGTH <= wt_bytes);
-			}
-			ptr_rdbuf += sprintf(ptr_rdbuf, ptr_data);
-			ptr_data = data_buf;
-		}
-	}
-	else {
-		struct list_item_int *item = NULL;
-		struct list_item_int *it = NULL;
-		list_for_each_entry_safe(item, it, data_list, links){
-			
-			nr_bytes = ptr_rdbuf - rd_buf;
-			to_wt = TEMP_BUFFER_LENGTH - nr_bytes;
-			
-			if (to_wt < sprintf(ptr_data, "%d\n", item->data)){
-				trace_printk("Modlist: Looping on buffer: %d out %d.\n", nr_bytes, TEMP_BUFFER_LENGTH);
-				do {
-					wt_bytes = snprintf(ptr_rdbuf, to_wt, ptr_data);
-					if (copy_to_user(ptr_buf, rd_buf, TEMP_BUFFER_LENGTH)){
-						spin_unlock(mtx);
-						return -EINVAL;
-					}
-					ptr_buf += TEMP_BUFFER_LENGTH - 1;		
-					ptr_rdbuf = rd_buf;
-					ptr_data += to_wt - 1;
-					total_bytes += TEMP_BUFFER_LENGTH - 1;
-					wt_bytes -= to_wt - 1;
-					to_wt = TEMP_BUFFER_LENGTH;
-				}while (TEMP_BUFFER_LENGTH <= wt_bytes);
+	item_len = data_cb->data_type ? MAX_SIZE : INT_TEXT_LENGTH;
+
+	text = kmalloc(sizeof(struct list_text), GFP_KERNEL);
+	if (!text)
+		return -ENOMEM;
+
+	for (retries = 0; ; retries++){
+		seq = read_begin(data_cb, retries);
+		need = READ_ONCE(data_cb->num_elem) * item_len + 1;
+		if (need > cap){
+			read_retry(data_cb, seq, retries);
+			vfree(kbuf);
+			cap = need;
+			kbuf = vmalloc(cap);
+			if (!kbuf){
+				kfree(text);
+				return -ENOMEM;
 			}
-			ptr_rdbuf += sprintf(ptr_rdbuf, ptr_data);
-			ptr_data = data_buf;
+			continue;
 		}
+		rcu_read_lock();
+		nr_bytes = format_list(data_cb, seq, kbuf, cap);
+		rcu_read_unlock();
+		if (!read_retry(data_cb, seq, retries) && nr_bytes >= 0)
+			break;
+		this_cpu_inc(data_cb->stats->retries);
 	}
-	spin_unlock(mtx);
-	total_bytes += ptr_rdbuf - rd_buf;
-		
-	if (len<total_bytes)
-		return -ENOSPC;
+	account_op(data_cb, OP_READ, start);
+
+	text->buf = kbuf;
+	text->len = nr_bytes;
+	filp->private_data = text;
+	return 0;
+}
+
+static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+
+	struct list_text *text = filp->private_data;
+	struct list_elem *data_cb=(struct list_elem *)PDE_DATA(filp->f_inode);
+	ssize_t nr_bytes;
 
 	/* Transfer data from the kernel to userspace */  
-	if (copy_to_user(ptr_buf, rd_buf, (ptr_rdbuf - rd_buf)))
-		return -EINVAL;
+	nr_bytes = simple_read_from_buffer(buf, len, off, text->buf, text->len);
+	if (nr_bytes > 0)
+		this_cpu_add(data_cb->stats->bytes_out, nr_bytes);
+	return nr_bytes; 
+}
 
-	(*off)+=total_bytes;  /* Update the file pointer */
+static int modlist_release(struct inode *inode, struct file *filp){
+	struct list_text *text = filp->private_data;
 
-	return total_bytes; 
+	if (text){
+		vfree(text->buf);
+		kfree(text);
+	}
+	return 0;
 }
 
 static const struct file_operations proc_entry_fops_others = {
+    .open = modlist_open,
     .read = modlist_read,
     .write = modlist_write,    
+    .release = modlist_release,
 };
 
+/* Nombres de /proc/multilist que no pueden usarse para una lista */
+static int reserved_name(const char *name){
+	return strcmp("admin", name) == 0 || strcmp("stats", name) == 0 || strcmp("snapshot", name) == 0;
+}
+
+/* Crea la lista y su entrada en /proc. Con multilist_sem cogido */
+static struct list_elem *create_list(const char *name, int type, unsigned int capacity, enum overflow_policy pol){
+	struct list_elem *data_cb;
+	struct proc_dir_entry *entry;
+
+	if (reserved_name(name) || find_list(name)){
+		printk(KERN_INFO "adminList: %s already exists\n", name);
+		return ERR_PTR(-EEXIST);
+	}
+	if (entries == max_entries){
+		printk(KERN_INFO "adminList: max entries raised\n");
+		return ERR_PTR(-ENOSPC);
+	}
+	data_cb = (struct list_elem *)vmalloc(sizeof(struct list_elem));
+	if (!data_cb)
+		return ERR_PTR(-ENOMEM);
+	if (setup_list_elem(data_cb, name, type, capacity, pol)){
+		vfree(data_cb);
+		return ERR_PTR(-ENOMEM);
+	}
+	link_list(data_cb);
+
+	entry = proc_create_data(name, 0666, multilist, &proc_entry_fops_others, data_cb);
+	if (!entry){
+		unlink_list(data_cb);
+		synchronize_rcu();
+		free_percpu(data_cb->stats);
+		vfree(data_cb);
+		return ERR_PTR(-ENOMEM);
+	}
+	entries++;
+	return data_cb;
+}
+
+/*
+ * union/intersect/diff A B -> C: A y B se copian como arrays de claves (el
+ * entero, o el puntero a la cadena compartida, que es el mismo para cadenas
+ * iguales) y el resultado se calcula con tablas hash, sin pasar por texto.
+ * C queda con los datos distintos del resultado, en el orden de A y luego
+ * de B; si no existe se crea con la capacidad y politica de A.
+ */
+enum set_op { SET_UNION, SET_INTERSECT, SET_DIFF };
+
+static const char *set_op_names[] = { "union", "intersect", "diff" };
+
+struct set_view {
+	unsigned long *keys;
+	size_t n;
+};
+
+/* Direccionamiento abierto; used marca los huecos ocupados */
+struct key_set {
+	unsigned long *slots;
+	unsigned long *used;
+	unsigned int bits;
+};
+
+/*
+ * Las cadenas de una vista llevan una referencia para que no cambien hasta
+ * view_free. Se cogen de INTERN_BATCH en INTERN_BATCH para no tener
+ * intern_lock (y las interrupciones software) bloqueados toda la lista.
+ */
+static void intern_hold(const unsigned long *keys, size_t n){
+	size_t i;
+
+	for (i = 0; i < n; i++){
+		if (i % INTERN_BATCH == 0)
+			spin_lock_bh(&intern_lock);
+		container_of((const char *)keys[i], struct intern_str, data[0])->refs++;
+		if (i % INTERN_BATCH == INTERN_BATCH - 1 || i == n - 1)
+			spin_unlock_bh(&intern_lock);
+	}
+}
+
+/*
+ * Copia elem con su cerrojo cogido (sin tocar seq: los lectores no tienen
+ * que repetir). Las referencias a las cadenas se cogen ya sin el cerrojo,
+ * dentro de rcu_read_lock(): una cadena no se suelta hasta un periodo de
+ * gracia despues de salir de la lista (reclaim_items).
+ */
+static int view_list(struct list_elem *elem, struct set_view *v){
+	struct list_head *pos;
+	unsigned int i, cap;
+
+	for (;;){
+		cap = READ_ONCE(elem->num_elem);
+		v->keys = vmalloc((cap + 1) * sizeof(unsigned long));
+		if (!v->keys)
+			return -ENOMEM;
+		spin_lock(&(elem->mtx));
+		if (elem->num_elem <= cap)
+			break;
+		spin_unlock(&(elem->mtx));
+		vfree(v->keys);
+	}
+	v->n = 0;
+	list_for_each(pos, &(elem->data_list)){
+		if (elem->data_type)
+			v->keys[v->n++] = (unsigned long)list_entry(pos, struct list_item_char, links)->data;
+		else {
+			struct int_block *block = list_entry(pos, struct int_block, links);
+			for (i = block->first; i < block->count; i++)
+				v->keys[v->n++] = (unsigned int)block->data[i];
+		}
+	}
+	rcu_read_lock();
+	spin_unlock(&(elem->mtx));
+	if (elem->data_type)
+		intern_hold(v->keys, v->n);
+	rcu_read_unlock();
+	return 0;
+}
+
+static void view_free(int type, struct set_view *v){
+	size_t i;
+
+	if (type)
+		for (i = 0; i < v->n; i++)
+			intern_put((const char *)v->keys[i]);
+	vfree(v->keys);
+}
+
+static int key_set_init(struct key_set *set, size_t n){
+	set->bits = ilog2(roundup_pow_of_two(2 * n + 2));
+	set->slots = vmalloc(sizeof(unsigned long) << set->bits);
+	set->used = vzalloc(BITS_TO_LONGS(1UL << set->bits) * sizeof(unsigned long));
+	if (!set->slots || !set->used){
+		vfree(set->slots);
+		vfree(set->used);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void key_set_free(struct key_set *set){
+	vfree(set->slots);
+	vfree(set->used);
+}
+
+/* Devuelve si key estaba; con insert, ademas la añade */
+static int key_set_probe(struct key_set *set, unsigned long key, int insert){
+	unsigned long mask = (1UL << set->bits) - 1;
+	unsigned long i;
+
+	for (i = hash_long(key, set->bits); test_bit(i, set->used); i = (i + 1) & mask)
+		if (set->slots[i] == key)
+			return 1;
+	if (insert){
+		__set_bit(i, set->used);
+		set->slots[i] = key;
+	}
+	return 0;
+}
+
+static int set_compute(enum set_op op, struct set_view *a, struct set_view *b, struct set_view *out){
+	struct key_set seen, in_b;
+	size_t i;
+
+	out->n = 0;
+	out->keys = vmalloc((a->n + b->n + 1) * sizeof(unsigned long));
+	if (!out->keys)
+		return -ENOMEM;
+	if (key_set_init(&seen, a->n + b->n))
+		return -ENOMEM;
+	if (op != SET_UNION){
+		if (key_set_init(&in_b, b->n)){
+			key_set_free(&seen);
+			return -ENOMEM;
+		}
+		for (i = 0; i < b->n; i++)
+			key_set_probe(&in_b, b->keys[i], 1);
+	}
+
+	for (i = 0; i < a->n; i++)
+		if ((op == SET_UNION || key_set_probe(&in_b, a->keys[i], 0) == (op == SET_INTERSECT)) &&
+				!key_set_probe(&seen, a->keys[i], 1))
+			out->keys[out->n++] = a->keys[i];
+	if (op == SET_UNION){
+		for (i = 0; i < b->n; i++)
+			if (!key_set_probe(&seen, b->keys[i], 1))
+				out->keys[out->n++] = b->keys[i];
+	}
+	else
+		key_set_free(&in_b);
+	key_set_free(&seen);
+	return 0;
+}
+
+/* Nodos para las claves de v, aun fuera de cualquier lista */
+static int build_items(int type, struct set_view *v, struct list_head *items){
+	struct list_item_char *item;
+	struct int_block *block = NULL;
+	size_t i;
+
+	for (i = 0; i < v->n; i++){
+		if (type){
+			item = kmem_cache_alloc(char_cache, GFP_KERNEL);
+			if (!item)
+				return -ENOMEM;
+			item->data = NULL;
+			list_add_tail(&(item->links), items);
+			atomic_inc(&nr_char_items);
+			continue;
+		}
+		if (!block || block->count == INT_BLOCK_SIZE){
+			block = alloc_int_block();
+			if (!block)
+				return -ENOMEM;
+			list_add_tail(&(block->links), items);
+		}
+		block->data[block->count++] = (int)v->keys[i];
+		atomic_inc(&nr_int_items);
+	}
+	if (type){
+		intern_hold(v->keys, v->n);
+		i = 0;
+		list_for_each_entry(item, items, links)
+			item->data = (const char *)v->keys[i++];
+	}
+	return 0;
+}
+
+/* Con multilist_sem cogido: A, B y C no se pueden borrar mientras tanto */
+static int set_algebra(enum set_op op, const char *name_a, const char *name_b, const char *name_c){
+	struct set_view a = { NULL, 0 }, b = { NULL, 0 }, out = { NULL, 0 };
+	struct list_elem *la, *lb, *dst;
+	LIST_HEAD(items);
+	LIST_HEAD(dead);
+	int err;
+
+	la = find_list(name_a);
+	lb = find_list(name_b);
+	if (!la || !lb)
+		return -ENOENT;
+	dst = find_list(name_c);
+	if (la->data_type != lb->data_type || (dst && dst->data_type != la->data_type)){
+		printk(KERN_INFO "adminList: %s, %s y %s deben ser del mismo tipo\n", name_a, name_b, name_c);
+		return -EINVAL;
+	}
+
+	if ((err = view_list(la, &a)) || (err = view_list(lb, &b)) || (err = set_compute(op, &a, &b, &out)))
+		goto out;
+	if (out.n > (dst ? list_capacity(dst) : list_capacity(la))){
+		err = -ENOSPC;
+		goto out;
+	}
+	if ((err = build_items(la->data_type, &out, &items)))
+		goto out;
+	if (!dst){
+		dst = create_list(name_c, la->data_type, la->capacity, la->policy);
+		if (IS_ERR(dst)){
+			err = PTR_ERR(dst);
+			goto out;
+		}
+	}
+
+	list_lock(dst);
+	list_splice_init(&(dst->data_list), &dead);
+	list_splice_tail_init(&items, &(dst->data_list));
+	dst->num_elem = out.n;
+	list_unlock(dst);
+	release_items(dst, &dead);
+out:
+	free_items(la->data_type, &items);
+	view_free(la->data_type, &a);
+	view_free(la->data_type, &b);
+	vfree(out.keys);
+	return err;
+}
+
 static ssize_t multilist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
 
 	/* scope local */
@@ -345,11 +1169,17 @@ static ssize_t multilist_write(struct file *filp, const char __user *buf, size_t
 	char type;
 	char temp[COMMANDS_LENGTH];
 
-	struct list_elem *data_cb;
-	struct proc_dir_entry *entry;
 	struct list_elem *elem = NULL;
-	struct list_elem *it_elem = NULL;
 	int enc = 0;
+	int n, i, ret;
+	unsigned int capacity = 0;
+	char policy[N_SIZE];
+	char opt[N_SIZE];
+	char extra[N_SIZE];
+	char op_name[N_SIZE];
+	char name_b[COMMANDS_LENGTH];
+	char name_c[COMMANDS_LENGTH];
+	enum overflow_policy pol = POLICY_REJECT;
 	
 	if ((*off) > 0) /* The application can write in this entry just once !! */
 		return 0;
@@ -368,11 +1198,33 @@ static ssize_t multilist_write(struct file *filp, const char __user *buf, size_t
 	
 	trace_printk("AdminList: Current command: %s", command_buf);
 	 
-	if(sscanf(command_buf, "new %s %c", temp, &type) == 2) {
+	/* La capacidad y la politica son opcionales: new t i, new t i 100, new t i ring, new t i 100 ring */
+	if((n = sscanf(command_buf, "new %s %c %15s %15s %15s", temp, &type, opt, policy, extra)) >= 2) {
 		if(strlen(temp) >= N_SIZE){
 			printk(KERN_INFO "adminList: name size < %d expected\n", N_SIZE);
 			return -ENOSPC;
 		}
+		if (type != 'i' && type != 's'){
+			printk(KERN_INFO "adminList: type i or s expected\n");
+			return -EINVAL;
+		}
+		if (n == 5 || (n == 4 && kstrtouint(opt, 10, &capacity))){
+			printk(KERN_INFO "adminList: new <name> <i|s> [capacity] [policy] expected\n");
+			return -EINVAL;
+		}
+		if (n == 3 && kstrtouint(opt, 10, &capacity))
+			strcpy(policy, opt);	// solo la politica
+		else if (n == 3)
+			n = 2;
+		if (n >= 3){
+			for (i = 0; i < ARRAY_SIZE(policy_names) && strcmp(policy, policy_names[i]); i++)
+				;
+			if (i == ARRAY_SIZE(policy_names) && strcmp(policy, "ring")){
+				printk(KERN_INFO "adminList: policy reject, drop-oldest (ring) or drop-newest expected\n");
+				return -EINVAL;
+			}
+			pol = (i == ARRAY_SIZE(policy_names)) ? POLICY_DROP_OLDEST : i;
+		}
 		if(down_interruptible(&multilist_sem)){
 			return -EINTR;
 		}
@@ -382,42 +1234,14 @@ static ssize_t multilist_write(struct file *filp, const char __user *buf, size_t
 			return -EFAULT;
 		}
 
-		if (entries == max_entries){
-			printk(KERN_INFO "adminList: max entries raised\n");
-			up(&multilist_sem);
-			return -ENOSPC;
-		}
-		data_cb = (struct list_elem *)vmalloc(sizeof(struct list_elem));
-		if (!data_cb){
-			up(&multilist_sem);
-			return -ENOMEM;
-		} 
-		if (type == 's'){
-			data_cb->data_type=1;
-		}
-		if (type == 'i'){
-			data_cb->data_type=0;
-		}
-		data_cb->num_elem=0;
-		spin_lock_init(&(data_cb->mtx));
-		strcpy(data_cb->name, temp);
-		INIT_LIST_HEAD(&(data_cb->data_list));
-		list_add_tail(&(data_cb->links), &list_entry);
-
-		entry = proc_create_data(temp, 0666, multilist, &proc_entry_fops_others, data_cb);
-		if (!entry){
-			up(&multilist_sem);
-			list_del(&(data_cb->links));
-			vfree(data_cb);
-			return -ENOMEM;
-		}
-		
-		entries++;
+		elem = create_list(temp, type == 's', capacity, pol);
 		up(&multilist_sem);
+		if (IS_ERR(elem))
+			return PTR_ERR(elem);
 	}
 	else if(sscanf(command_buf, "delete %s", temp) == 1){
-		if (strcmp("admin", temp) == 0){
-			printk(KERN_INFO "ERROR: can not delete admin.\n");
+		if (reserved_name(temp)){
+			printk(KERN_INFO "ERROR: can not delete %s.\n", temp);
 			return -EINVAL;
 		}
 		if(down_interruptible(&multilist_sem)){
@@ -430,40 +1254,53 @@ static ssize_t multilist_write(struct file *filp, const char __user *buf, size_t
 			return -EFAULT;
 		}
 
-		list_for_each_entry_safe(elem, it_elem, &list_entry, links){
-			if(strcmp(elem->name, temp) == 0){
-				spin_lock(&(elem->mtx));
-				if (elem->data_type){
-					struct list_item_char *item = NULL;
-					struct list_item_char *it = NULL;
-					list_for_each_entry_safe(item, it, &(elem->data_list), links){ // esto recorre las entradas de la lista
-						list_del(&(item->links));
-						vfree(item->data);
-						vfree(item);
-					}
-				}
-				else {
-					struct list_item_int *item = NULL;
-					struct list_item_int *it = NULL;
-					list_for_each_entry_safe(item, it, &(elem->data_list), links){ // esto recorre las entradas de la lista
-						list_del(&(item->links));
-						vfree(item);
-					}
-				}
-				spin_unlock(&(elem->mtx));
-				list_del(&(elem->links));
-				vfree(elem);
-				remove_proc_entry(elem->name, multilist);
-				entries--;
-				enc = 1;
-				break;
-			}
+		elem = find_list(temp);
+		if (elem){
+			/*
+			 * remove_proc_entry espera a las lecturas y escrituras en curso
+			 * sobre la lista y no deja empezar otras; synchronize_rcu espera
+			 * a los que recorren list_entry y rcu_barrier a los reclaim_rcu.
+			 */
+			remove_proc_entry(elem->name, multilist);
+			unlink_list(elem);
+			synchronize_rcu();
+			empty_list(elem);
+			rcu_barrier();
+			free_items(elem->data_type, &(elem->pool));
+			free_percpu(elem->stats);
+			vfree(elem);
+			entries--;
+			enc = 1;
 		}
 		up(&multilist_sem);
 		if (!enc){
 			return -ENOENT;
 		}
 	}
+	else if(sscanf(command_buf, "%15s %s %s -> %s", op_name, temp, name_b, name_c) == 4){
+		for (i = 0; i < ARRAY_SIZE(set_op_names) && strcmp(op_name, set_op_names[i]); i++)
+			;
+		if (i == ARRAY_SIZE(set_op_names)){
+			printk(KERN_INFO "ERROR: comando inválido.\n");
+			return -EINVAL;
+		}
+		if(strlen(name_c) >= N_SIZE){
+			printk(KERN_INFO "adminList: name size < %d expected\n", N_SIZE);
+			return -ENOSPC;
+		}
+		if(down_interruptible(&multilist_sem)){
+			return -EINTR;
+		}
+		if (terminado){
+			printk(KERN_INFO "adminList: modulo descargado, operation cancelled\n");
+			up(&multilist_sem);
+			return -EFAULT;
+		}
+		ret = set_algebra(i, temp, name_b, name_c);
+		up(&multilist_sem);
+		if (ret)
+			return ret;
+	}
 	else {
 		printk(KERN_INFO "ERROR: comando inválido.\n");
 		return -EINVAL;
@@ -471,19 +1308,547 @@ static ssize_t multilist_write(struct file *filp, const char __user *buf, size_t
 	return len;
 }
 
+/*
+ * /proc/multilist/snapshot (ver multilist_image.h). Al abrirlo para leer se
+ * construye la imagen entera en un buffer, recorriendo cada lista sin
+ * cerrojos como modlist_read. Al escribir, la imagen se procesa segun llega
+ * y los datos de cada lista se añaden de golpe cuando esta completa.
+ */
+struct snapshot_dump {
+	char *buf;
+	size_t len, cap;
+};
+
+/* Hace sitio para n bytes mas en la imagen */
+static int dump_reserve(struct snapshot_dump *dump, size_t n){
+	size_t cap;
+	char *buf;
+
+	if (dump->len + n <= dump->cap)
+		return 0;
+	cap = max(dump->cap * 2, dump->len + n);
+	buf = vmalloc(cap);
+	if (!buf)
+		return -ENOMEM;
+	if (dump->buf)
+		memcpy(buf, dump->buf, dump->len);
+	vfree(dump->buf);
+	dump->buf = buf;
+	dump->cap = cap;
+	return 0;
+}
+
+/* Copia los datos de una lista a dst bajo rcu_read_lock(), validando con seq como format_list */
+static ssize_t image_items(struct list_elem *elem, unsigned int seq, char *dst, size_t cap, u64 *count){
+	struct list_head *pos = READ_ONCE(elem->data_list.next);
+	size_t nr_bytes = 0, n;
+	unsigned int first, last;
+
+	*count = 0;
+	while (pos != &(elem->data_list)){
+		if (read_seqcount_retry(&(elem->seq), seq))
+			return -EAGAIN;
+		if (elem->data_type){
+			struct list_item_char *item = list_entry(pos, struct list_item_char, links);
+			const char *data = READ_ONCE(item->data);
+			n = strnlen(data, MAX_SIZE - 1);
+			if (nr_bytes + 1 + n > cap)
+				return -EAGAIN;
+			dst[nr_bytes] = n;
+			memcpy(dst + nr_bytes + 1, data, n);
+			nr_bytes += 1 + n;
+			(*count)++;
+		}
+		else {
+			struct int_block *block = list_entry(pos, struct int_block, links);
+			last = min_t(unsigned int, READ_ONCE(block->count), INT_BLOCK_SIZE);
+			first = min_t(unsigned int, READ_ONCE(block->first), last);
+			n = (last - first) * sizeof(int);
+			if (nr_bytes + n > cap)
+				return -EAGAIN;
+			memcpy(dst + nr_bytes, block->data + first, n);
+			nr_bytes += n;
+			*count += last - first;
+		}
+		pos = READ_ONCE(pos->next);
+	}
+	return nr_bytes;
+}
+
+static int dump_list(struct snapshot_dump *dump, struct list_elem *elem){
+	struct multilist_image_list hdr;
+	size_t item_len = elem->data_type ? MAX_SIZE : sizeof(int);
+	size_t need;
+	unsigned int seq;
+	ssize_t n;
+	int err, retries;
+
+	memset(&hdr, 0, sizeof(hdr));
+	strcpy(hdr.name, elem->name);
+	hdr.type = elem->data_type;
+	hdr.policy = elem->policy;
+	hdr.capacity = elem->capacity;
+	for (retries = 0; ; retries++){
+		seq = read_begin(elem, retries);
+		need = sizeof(hdr) + READ_ONCE(elem->num_elem) * item_len;
+		if (dump->len + need > dump->cap){
+			read_retry(elem, seq, retries);
+			if ((err = dump_reserve(dump, need)))
+				return err;
+			continue;
+		}
+		rcu_read_lock();
+		n = image_items(elem, seq, dump->buf + dump->len + sizeof(hdr),
+				dump->cap - dump->len - sizeof(hdr), &hdr.count);
+		rcu_read_unlock();
+		if (!read_retry(elem, seq, retries) && n >= 0)
+			break;
+	}
+	memcpy(dump->buf + dump->len, &hdr, sizeof(hdr));
+	dump->len += sizeof(hdr) + n;
+	return 0;
+}
+
+/* Con multilist_sem cogido para que no se creen ni borren listas entre medias */
+static int build_image(struct snapshot_dump *dump){
+	struct multilist_image_header hdr;
+	struct list_elem *elem;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MULTILIST_IMAGE_MAGIC, sizeof(hdr.magic));
+	hdr.version = MULTILIST_IMAGE_VERSION;
+
+	if (down_interruptible(&multilist_sem))
+		return -EINTR;
+	err = dump_reserve(dump, sizeof(hdr));
+	dump->len = sizeof(hdr);
+	list_for_each_entry(elem, &list_entry, links){
+		if (err || (err = dump_list(dump, elem)))
+			break;
+		hdr.nr_lists++;
+	}
+	up(&multilist_sem);
+	if (!err)
+		memcpy(dump->buf, &hdr, sizeof(hdr));
+	return err;
+}
+
+enum load_stage { LOAD_HEADER, LOAD_LIST, LOAD_ITEMS, LOAD_DONE };
+
+struct snapshot_load {
+	enum load_stage stage;
+	u32 lists_left;
+	struct multilist_image_list hdr;	// lista en curso
+	u64 left;							// datos que faltan de la lista en curso
+	struct list_head items;				// datos ya leidos de la lista en curso
+	unsigned int nr_items;
+	int str_len;						// longitud de la cadena en curso, -1 si aun no se ha leido
+	char carry[MAX_SIZE];				// registro partido entre dos write
+	size_t carry_len;
+	int error;							// tras un error se rechaza el resto de la imagen
+};
+
+/*
+ * Devuelve los need bytes siguientes de la imagen: directamente de p o, si
+ * el registro viene partido, juntandolos en carry. NULL si aun no han llegado.
+ */
+static const void *take(struct snapshot_load *load, const char **p, size_t *avail, size_t need){
+	const void *rec = *p;
+	size_t n;
+
+	if (!load->carry_len && *avail >= need){
+		*p += need;
+		*avail -= need;
+		return rec;
+	}
+	n = min(need - load->carry_len, *avail);
+	memcpy(load->carry + load->carry_len, *p, n);
+	load->carry_len += n;
+	*p += n;
+	*avail -= n;
+	if (load->carry_len < need)
+		return NULL;
+	load->carry_len = 0;
+	return load->carry;
+}
+
+/*
+ * Cabecera de una lista, con multilist_sem cogido: solo se comprueba que
+ * cabe. La lista no se toca hasta load_commit, asi que una imagen que
+ * falla a medias no deja ninguna lista a medio reemplazar.
+ */
+static int load_list(struct snapshot_load *load){
+	struct multilist_image_list *hdr = &(load->hdr);
+	struct list_elem *elem;
+	unsigned int capacity;
+
+	if (!hdr->name[0] || hdr->name[N_SIZE - 1] || hdr->type > 1 || hdr->policy >= ARRAY_SIZE(policy_names))
+		return -EINVAL;
+	elem = find_list(hdr->name);
+	if (elem && elem->data_type != hdr->type)
+		return -EINVAL;
+	capacity = elem ? list_capacity(elem) : (hdr->capacity ? hdr->capacity : max_size);
+	if (hdr->count > capacity){
+		printk(KERN_INFO "Multilist: %s no cabe en la lista (%llu datos)\n", hdr->name, hdr->count);
+		return -ENOSPC;
+	}
+	load->left = hdr->count;
+	load->nr_items = 0;
+	load->str_len = -1;
+	return 0;
+}
+
+/* Rellena bloques enteros con memcpy, sin pasar por add */
+static int load_ints(struct snapshot_load *load, const char *src, size_t n){
+	struct int_block *block;
+	size_t k;
+
+	while (n){
+		block = list_empty(&(load->items)) ? NULL : list_last_entry(&(load->items), struct int_block, links);
+		if (!block || block->count == INT_BLOCK_SIZE){
+			block = alloc_int_block();
+			if (!block)
+				return -ENOMEM;
+			list_add_tail(&(block->links), &(load->items));
+		}
+		k = min_t(size_t, n, INT_BLOCK_SIZE - block->count);
+		memcpy(block->data + block->count, src, k * sizeof(int));
+		block->count += k;
+		atomic_add(k, &nr_int_items);
+		load->nr_items += k;
+		load->left -= k;
+		src += k * sizeof(int);
+		n -= k;
+	}
+	return 0;
+}
+
+static int load_string(struct snapshot_load *load, const char *src, size_t len){
+	struct list_item_char *item;
+	char str[MAX_SIZE];
+
+	memcpy(str, src, len);
+	str[len] = '\0';
+	if (strlen(str) != len)
+		return -EINVAL;
+	item = alloc_item_char(str);
+	if (!item)
+		return -ENOMEM;
+	list_add_tail(&(item->links), &(load->items));
+	load->nr_items++;
+	load->left--;
+	return 0;
+}
+
+/*
+ * Lista completa: se crea si no existe y sus datos sustituyen a los que
+ * tenia de una vez, con un solo list_lock, como en set_algebra. Lo añadido
+ * entre dos write se descarta con el resto del contenido anterior.
+ */
+static int load_commit(struct snapshot_load *load){
+	struct multilist_image_list *hdr = &(load->hdr);
+	struct list_elem *elem = find_list(hdr->name);
+	LIST_HEAD(dead);
+
+	if (!elem){
+		elem = create_list(hdr->name, hdr->type, hdr->capacity, hdr->policy);
+		if (IS_ERR(elem))
+			return PTR_ERR(elem);
+	}
+	if (elem->data_type != hdr->type)
+		return -EINVAL;		// borrada y creada de otro tipo entre dos write
+	if (load->nr_items > list_capacity(elem))
+		return -ENOSPC;
+	list_lock(elem);
+	list_splice_init(&(elem->data_list), &dead);
+	list_splice_tail_init(&(load->items), &(elem->data_list));
+	elem->num_elem = load->nr_items;
+	list_unlock(elem);
+	release_items(elem, &dead);
+	load->lists_left--;
+	load->stage = load->lists_left ? LOAD_LIST : LOAD_DONE;
+	return 0;
+}
+
+static int load_chunk(struct snapshot_load *load, const char *p, size_t avail){
+	const struct multilist_image_header *ihdr;
+	const void *rec;
+	size_t n;
+	int err = 0;
+
+	while (avail || (load->stage == LOAD_ITEMS && !load->left)){
+		switch (load->stage){
+		case LOAD_HEADER:
+			if (!(ihdr = take(load, &p, &avail, sizeof(*ihdr))))
+				return 0;
+			if (memcmp(ihdr->magic, MULTILIST_IMAGE_MAGIC, sizeof(ihdr->magic)) ||
+					ihdr->version != MULTILIST_IMAGE_VERSION){
+				printk(KERN_INFO "Multilist: imagen no valida o de otra version\n");
+				return -EINVAL;
+			}
+			load->lists_left = ihdr->nr_lists;
+			load->stage = load->lists_left ? LOAD_LIST : LOAD_DONE;
+			break;
+		case LOAD_LIST:
+			if (!(rec = take(load, &p, &avail, sizeof(load->hdr))))
+				return 0;
+			memcpy(&(load->hdr), rec, sizeof(load->hdr));
+			if ((err = load_list(load)))
+				return err;
+			load->stage = LOAD_ITEMS;
+			break;
+		case LOAD_ITEMS:
+			if (!load->left)
+				err = load_commit(load);
+			else if (load->hdr.type){
+				if (load->str_len < 0){
+					if (!(rec = take(load, &p, &avail, 1)))
+						return 0;
+					load->str_len = *(const u8 *)rec;
+					if (!load->str_len || load->str_len >= MAX_SIZE)
+						return -EINVAL;
+				}
+				if (!(rec = take(load, &p, &avail, load->str_len)))
+					return 0;
+				err = load_string(load, rec, load->str_len);
+				load->str_len = -1;
+			}
+			else if (load->carry_len || avail < sizeof(int)){
+				if (!(rec = take(load, &p, &avail, sizeof(int))))
+					return 0;
+				err = load_ints(load, rec, 1);
+			}
+			else {
+				n = min_t(u64, load->left, avail / sizeof(int));
+				err = load_ints(load, p, n);
+				p += n * sizeof(int);
+				avail -= n * sizeof(int);
+			}
+			if (err)
+				return err;
+			break;
+		case LOAD_DONE:
+			return -EINVAL;		// datos despues de la ultima lista
+		}
+	}
+	return 0;
+}
+
+static int snapshot_open(struct inode *inode, struct file *filp){
+	struct snapshot_load *load;
+	struct snapshot_dump *dump;
+	int err;
+
+	if ((filp->f_mode & FMODE_READ) && (filp->f_mode & FMODE_WRITE))
+		return -EINVAL;
+	if (filp->f_mode & FMODE_WRITE){
+		load = kzalloc(sizeof(struct snapshot_load), GFP_KERNEL);
+		if (!load)
+			return -ENOMEM;
+		load->stage = LOAD_HEADER;
+		INIT_LIST_HEAD(&(load->items));
+		load->str_len = -1;
+		filp->private_data = load;
+		return 0;
+	}
+	dump = kzalloc(sizeof(struct snapshot_dump), GFP_KERNEL);
+	if (!dump)
+		return -ENOMEM;
+	if ((err = build_image(dump))){
+		vfree(dump->buf);
+		kfree(dump);
+		return err;
+	}
+	filp->private_data = dump;
+	return 0;
+}
+
+static ssize_t snapshot_read(struct file *filp, char __user *buf, size_t len, loff_t *off){
+	struct snapshot_dump *dump = filp->private_data;
+
+	return simple_read_from_buffer(buf, len, off, dump->buf, dump->len);
+}
+
+static ssize_t snapshot_write(struct file *filp, const char __user *buf, size_t len, loff_t *off){
+	struct snapshot_load *load = filp->private_data;
+	size_t done, chunk;
+	char *kbuf;
+	int err = load->error;
+
+	if (err)
+		return err;
+	kbuf = (char *)__get_free_page(GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+	if (down_interruptible(&multilist_sem)){
+		free_page((unsigned long)kbuf);
+		return -EINTR;
+	}
+	for (done = 0; done < len && !err; done += chunk){
+		chunk = min_t(size_t, len - done, PAGE_SIZE);
+		if (copy_from_user(kbuf, buf + done, chunk))
+			err = -EFAULT;
+		else
+			err = load_chunk(load, kbuf, chunk);
+	}
+	up(&multilist_sem);
+	free_page((unsigned long)kbuf);
+
+	if (err){
+		load->error = err;
+		return err;
+	}
+	(*off)+=len;
+	return len;
+}
+
+static int snapshot_release(struct inode *inode, struct file *filp){
+	if (filp->f_mode & FMODE_WRITE){
+		struct snapshot_load *load = filp->private_data;
+		if (!load->error && load->stage != LOAD_DONE)
+			printk(KERN_INFO "Multilist: imagen incompleta, %s no se ha cargado\n", load->hdr.name);
+		free_items(load->hdr.type, &(load->items));
+		kfree(load);
+	}
+	else {
+		struct snapshot_dump *dump = filp->private_data;
+		vfree(dump->buf);
+		kfree(dump);
+	}
+	return 0;
+}
+
+static const struct file_operations proc_entry_fops_snapshot = {
+    .open = snapshot_open,
+    .read = snapshot_read,
+    .write = snapshot_write,
+    .release = snapshot_release,
+};
+
+/*
+ * Lectura de admin: objetos vivos en cada cache de nodos, cadenas
+ * compartidas y trozos de su arena, y una linea por lista (nombre, tipo, elementos/capacidad y politica), recorriendo
+ * list_entry bajo RCU sin coger multilist_sem.
+ */
+static ssize_t multilist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+
+	struct list_elem *elem;
+	size_t cap = STATS_LENGTH + (READ_ONCE(entries) + 1) * LIST_LINE_LENGTH;
+	char *kbuf;
+	int nr_bytes;
+
+	if ((*off) > 0) /* Tell the application that there is nothing left to read */
+		return 0;
+
+	kbuf = vmalloc(cap);
+	if (!kbuf)
+		return -ENOMEM;
+
+	nr_bytes = scnprintf(kbuf, cap, "multilist_int: %d\nmultilist_int_blocks: %d\nmultilist_char: %d\nmultilist_strings: %u\nmultilist_arena_chunks: %u\n",
+			atomic_read(&nr_int_items), atomic_read(&nr_int_blocks), atomic_read(&nr_char_items),
+			READ_ONCE(nr_strings), READ_ONCE(nr_chunks));
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(elem, &list_entry, links)
+		nr_bytes += scnprintf(kbuf + nr_bytes, cap - nr_bytes, "%s %c %u/%u %s\n", elem->name,
+				elem->data_type ? 's' : 'i', READ_ONCE(elem->num_elem), list_capacity(elem), policy_names[elem->policy]);
+	rcu_read_unlock();
+
+	if (len < nr_bytes){
+		vfree(kbuf);
+		return -ENOSPC;
+	}
+
+	if (copy_to_user(buf, kbuf, nr_bytes)){
+		vfree(kbuf);
+		return -EFAULT;
+	}
+	vfree(kbuf);
+
+	(*off)+=nr_bytes;
+
+	return nr_bytes;
+}
+
 static const struct file_operations proc_entry_fops_admin = {
+    .read = multilist_read,
     .write = multilist_write,    
 };
 
+static u64 stat_sum(struct list_elem *elem, size_t offset){
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((char *)per_cpu_ptr(elem->stats, cpu) + offset);
+	return sum;
+}
+
+#define STAT_SUM(elem, field)	stat_sum(elem, offsetof(struct list_stats, field))
+
+/*
+ * /proc/multilist/stats: una linea de contadores por lista y, debajo, el
+ * histograma de latencias de cada operacion (solo las cubetas no vacias,
+ * con su limite inferior en ns). Recorre list_entry bajo RCU y suma los
+ * contadores de cada CPU sin coger ningun cerrojo.
+ */
+static int multilist_stats_show(struct seq_file *m, void *v){
+	struct list_elem *elem;
+	size_t offset;
+	u64 n;
+	int op, b;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(elem, &list_entry, links){
+		seq_printf(m, "%s: adds %llu removes %llu reads %llu bytes_out %llu nospc %llu dropped %llu contended %llu retries %llu\n",
+				elem->name, STAT_SUM(elem, ops[OP_ADD]), STAT_SUM(elem, ops[OP_REMOVE]), STAT_SUM(elem, ops[OP_READ]),
+				STAT_SUM(elem, bytes_out), STAT_SUM(elem, nospc), STAT_SUM(elem, dropped),
+				STAT_SUM(elem, contended), STAT_SUM(elem, retries));
+		for (op = 0; op < NR_OPS; op++){
+			seq_printf(m, "  %s_ns:", op_names[op]);
+			for (b = 0; b < HIST_BUCKETS; b++){
+				offset = offsetof(struct list_stats, hist) + (op * HIST_BUCKETS + b) * sizeof(u64);
+				if ((n = stat_sum(elem, offset)))
+					seq_printf(m, " %llu:%llu", b ? 1ULL << (b - 1) : 0ULL, n);
+			}
+			seq_putc(m, '\n');
+		}
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static int multilist_stats_open(struct inode *inode, struct file *filp){
+	return single_open(filp, multilist_stats_show, NULL);
+}
+
+static const struct file_operations proc_entry_fops_stats = {
+    .open = multilist_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
 int init_modlist_module( void ){
 	
 	int ret = 0;
 	struct list_elem *data_cb;
 	struct proc_dir_entry *test_entry;
 
+	int_cache = kmem_cache_create("multilist_int", sizeof(struct int_block), 0, 0, NULL);
+	char_cache = kmem_cache_create("multilist_char", sizeof(struct list_item_char), 0, 0, NULL);
+	if (!int_cache || !char_cache){
+		kmem_cache_destroy(int_cache);
+		kmem_cache_destroy(char_cache);
+		return -ENOMEM;
+	}
+
 	multilist = proc_mkdir("multilist", NULL);
 
 	if (!multilist) {
+		kmem_cache_destroy(int_cache);
+		kmem_cache_destroy(char_cache);
         return -ENOMEM;
     }
 
@@ -491,29 +1856,51 @@ int init_modlist_module( void ){
 	if (!proc_entry_admin){
 		remove_proc_entry("multilist", NULL);
 	}
+	proc_entry_stats = proc_create( "stats", 0444, multilist, &proc_entry_fops_stats);
+	if (!proc_entry_stats){
+		remove_proc_entry("admin", multilist);
+		remove_proc_entry("multilist", NULL);
+		kmem_cache_destroy(int_cache);
+		kmem_cache_destroy(char_cache);
+		return -ENOMEM;
+	}
+	proc_entry_snapshot = proc_create( "snapshot", 0600, multilist, &proc_entry_fops_snapshot);
+	if (!proc_entry_snapshot){
+		remove_proc_entry("stats", multilist);
+		remove_proc_entry("admin", multilist);
+		remove_proc_entry("multilist", NULL);
+		kmem_cache_destroy(int_cache);
+		kmem_cache_destroy(char_cache);
+		return -ENOMEM;
+	}
 	
 	sema_init(&multilist_sem, 1);
 	INIT_LIST_HEAD(&list_entry);
 
 	data_cb = (struct list_elem *)vmalloc(sizeof(struct list_elem));
-	if (!data_cb){
+	if (!data_cb || setup_list_elem(data_cb, "test", 0, 0, POLICY_REJECT)){
+		vfree(data_cb);
+		remove_proc_entry("snapshot", multilist);
+		remove_proc_entry("stats", multilist);
 		remove_proc_entry("admin", multilist);
 		remove_proc_entry("multilist", NULL);
+		kmem_cache_destroy(int_cache);
+		kmem_cache_destroy(char_cache);
 		return -ENOMEM;
 	} 
-	data_cb->data_type=0;
-	data_cb->num_elem=0;
-	spin_lock_init(&(data_cb->mtx));
-	strcpy(data_cb->name, "test");
-	INIT_LIST_HEAD(&(data_cb->data_list));
-	list_add_tail(&(data_cb->links), &list_entry);
+	link_list(data_cb);
 
 	test_entry = proc_create_data( "test", 0666, multilist, &proc_entry_fops_others, data_cb);
 	if (!test_entry){
+		remove_proc_entry("snapshot", multilist);
+		remove_proc_entry("stats", multilist);
 		remove_proc_entry("admin", multilist);
 		remove_proc_entry("multilist", NULL);
-		list_del(&(data_cb->links));
+		unlink_list(data_cb);
+		free_percpu(data_cb->stats);
 		vfree(data_cb);
+		kmem_cache_destroy(int_cache);
+		kmem_cache_destroy(char_cache);
 		return -ENOMEM;
 	}
 	entries++;
@@ -526,9 +1913,14 @@ int init_modlist_module( void ){
 
 void exit_modlist_module( void )
 {	
-	multilist_cleanup();
+	remove_proc_entry("snapshot", multilist);
+	remove_proc_entry("stats", multilist);
 	remove_proc_entry("admin", multilist);
+	multilist_cleanup();
+	arena_destroy();
 	remove_proc_entry("multilist", NULL); // eliminar la entrada del /proc
+	kmem_cache_destroy(int_cache);
+	kmem_cache_destroy(char_cache);
 	printk(KERN_INFO "Multilist: Module unloaded.\n");
 }
 
@@ -0,0 +1,44 @@
+#ifndef MULTILIST_IMAGE_H
+#define MULTILIST_IMAGE_H
+
+/*
+ * Formato binario de /proc/multilist/snapshot, compartido por el modulo y
+ * los programas de usuario. Leer el fichero devuelve una imagen de todas
+ * las listas y escribir una imagen las reconstruye:
+ *
+ *   cat /proc/multilist/snapshot > listas.img
+ *   (rmmod multilist; insmod multilist.ko max_size=...)
+ *   cat listas.img > /proc/multilist/snapshot
+ *
+ * Una imagen es una multilist_image_header seguida de nr_lists listas, cada
+ * una con su multilist_image_list y count datos: __s32 para las listas de
+ * enteros y, para las de cadenas, un byte de longitud seguido de la cadena
+ * sin '\0'. Todo va en el orden de bytes de la maquina.
+ *
+ * Las listas que no existen se crean con su capacidad y politica; si ya
+ * existen (como test) y son del mismo tipo su contenido se sustituye de
+ * una vez cuando han llegado todos sus datos.
+ */
+
+#include <linux/types.h>
+
+#define MULTILIST_IMAGE_MAGIC	"MLST"
+#define MULTILIST_IMAGE_VERSION	1
+
+struct multilist_image_header {
+	char magic[4];			// MULTILIST_IMAGE_MAGIC
+	__u32 version;			// MULTILIST_IMAGE_VERSION
+	__u32 nr_lists;
+	__u32 pad;
+};
+
+struct multilist_image_list {
+	char name[16];			// terminado en '\0'
+	__u8 type;				// 0: enteros, 1: cadenas
+	__u8 policy;			// 0: reject, 1: drop-oldest, 2: drop-newest
+	__u16 pad;
+	__u32 capacity;			// 0: la del parametro max_size
+	__u64 count;			// datos que siguen
+};
+
+#endif
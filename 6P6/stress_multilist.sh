@@ -0,0 +1,82 @@
+#!/bin/bash
+# Uso: sudo ./stress_multilist.sh [listas] [lectores] [escritores] [segundos]
+# Crea varias listas en /proc/multilist y lanza a la vez, por cada lista,
+# N lectores (cat) y M escritores (add/remove/cleanup), mas un proceso que
+# crea y borra otra lista sin parar. Pensado para un kernel con
+# CONFIG_PROVE_LOCKING y CONFIG_DEBUG_ATOMIC_SLEEP: al final busca en dmesg
+# avisos de lockdep o de "sleeping function called from invalid context".
+
+LISTS=${1:-4}
+READERS=${2:-4}
+WRITERS=${3:-4}
+SECS=${4:-10}
+ADMIN=/proc/multilist/admin
+TMP=$(mktemp -d)
+
+lector() {
+	local n=0
+	local end=$((SECONDS + SECS))
+	while [ $SECONDS -lt $end ]; do
+		cat /proc/multilist/$1 > /dev/null 2>&1
+		n=$((n+1))
+	done
+	echo $n > $TMP/lector$1.$2
+}
+
+escritor() {
+	local n=0
+	local end=$((SECONDS + SECS))
+	while [ $SECONDS -lt $end ]; do
+		echo add $((n + $2 * 1000000)) > /proc/multilist/$1 2>/dev/null
+		echo remove $((n + $2 * 1000000)) > /proc/multilist/$1 2>/dev/null
+		if [ $((n % 100)) -eq 0 ]; then
+			echo cleanup > /proc/multilist/$1
+		fi
+		n=$((n+1))
+	done
+	echo $n > $TMP/escritor$1.$2
+}
+
+creador() {
+	local n=0
+	local end=$((SECONDS + SECS))
+	while [ $SECONDS -lt $end ]; do
+		echo new stress_tmp i > $ADMIN 2>/dev/null
+		echo add $n > /proc/multilist/stress_tmp 2>/dev/null
+		echo delete stress_tmp > $ADMIN 2>/dev/null
+		n=$((n+1))
+	done
+	echo $n > $TMP/creador
+}
+
+MARK="stress_multilist $$"
+echo "$MARK" > /dev/kmsg
+echo $((LISTS + 2)) > /sys/module/multilist/parameters/max_entries
+echo 1000 > /sys/module/multilist/parameters/max_size
+
+for ((l=0; $l<$LISTS; l++)); do
+	echo new stress$l i > $ADMIN || exit 1
+done
+
+for ((l=0; $l<$LISTS; l++)); do
+	for ((i=0; $i<$READERS; i++)); do lector stress$l $i & done
+	for ((i=0; $i<$WRITERS; i++)); do escritor stress$l $i & done
+done
+creador &
+wait
+
+echo "$LISTS listas, $READERS lectores y $WRITERS escritores por lista, $SECS s"
+cat $TMP/lector* | awk -v s=$SECS '{ t += $1 } END { printf "lecturas (cat completos)/s: %.1f\n", t / s }'
+cat $TMP/escritor* | awk -v s=$SECS '{ t += $1 } END { printf "escrituras (add+remove)/s: %.1f\n", t / s }'
+echo "listas creadas y borradas: $(cat $TMP/creador)"
+
+for ((l=0; $l<$LISTS; l++)); do
+	echo delete stress$l > $ADMIN
+done
+rm -rf $TMP
+
+if dmesg | sed -n "/$MARK/,\$p" | grep -E "lockdep|possible .*deadlock|sleeping function|BUG:"; then
+	echo "FALLO: avisos del kernel durante la prueba"
+	exit 1
+fi
+echo "OK: sin avisos del kernel"
@@ -2,90 +2,710 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/string.h>
+#include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/uaccess.h>
 #include <linux/ftrace.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/crypto.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+
+#include "clipboard_mmap.h"
 
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Clipboard Kernel Module - FDI-UCM");
 MODULE_AUTHOR("Juan Carlos Saez");
 
-#define BUFFER_LENGTH       PAGE_SIZE
+static unsigned int max_pages = 4096;  /* 16MB with 4K pages */
+
+module_param(max_pages, uint, 0444);
+MODULE_PARM_DESC(max_pages, "Maximum size of the clipboard, in pages");
+
+static char *compress = "";
+
+module_param(compress, charp, 0444);
+MODULE_PARM_DESC(compress, "Compression algorithm for large clipboards (lz4, lzo, deflate...), none if empty");
+
+static struct proc_dir_entry *proc_entry, *stats_entry;
+static struct page *header;        // struct clipboard_shm, mappable by user programs
+static struct clipboard_shm *shm;  // page_address(header)
+
+/*
+ * The "clipboard" is a list of pages, one pointer per page, so large
+ * payloads never need a big contiguous allocation. Pages are allocated as
+ * the clipboard grows and kept when it is truncated, so a mapping never
+ * loses them. When the list fills up a bigger copy replaces it.
+ *
+ * With the compress parameter set, the full pages of a clipboard larger than
+ * one page are kept compressed instead, each one on its own so that reads
+ * can start anywhere. They are uncompressed as they are read.
+ */
+struct clipboard_zpage {
+  unsigned int len;      // Bytes of data[]
+  u8 data[];
+};
+
+struct clipboard_chunk {
+  struct page *page;           // Plain contents, or
+  struct clipboard_zpage *z;   // compressed contents: exactly one is set
+};
+
+struct clipboard_pages {
+  struct rcu_head rcu;
+  unsigned int nr;       // Chunks allocated
+  unsigned int cap;      // Slots in chunk[]
+  struct clipboard_chunk chunk[];
+};
+
+/*
+ * Readers never block: they copy under rcu_read_lock() and check cb_seq
+ * afterwards, retrying if a write was published meanwhile. Writers never
+ * modify bytes a reader can see: the pages they overwrite are copied, and
+ * the copies are swapped in inside a short cb_seq write section. The old
+ * pages are freed after an RCU grace period.
+ */
+static struct clipboard_pages __rcu *cb;
+static size_t size = 0;            // Bytes of the clipboard
+static seqcount_t cb_seq;          /* Protects (cb->chunk[], size) for readers */
+
+static DEFINE_MUTEX(clipboard_mtx);  /* Serializes writers and mmap faults, mmap readers rely on shm->seq */
+
+/*
+ * Every write (or truncation) starts a new generation, shm->seq / 2. poll()
+ * reports POLLIN once the generation differs from the one this descriptor
+ * last read, and CLIPBOARD_IOC_GENERATION tells how many were skipped.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(clipboard_wq);
+
+struct clipboard_reader {
+  u32 seen;  /* Generation returned by the last read(), or current at open() */
+};
+
+/*
+ * Every CPU has its own transform, used with preemption disabled, so readers
+ * uncompress in parallel. Writers compress into zbuf under clipboard_mtx and
+ * keep the result only if it saves an eighth of the page or more.
+ */
+#define ZBUF_SIZE (2 * PAGE_SIZE)
+
+static struct crypto_comp * __percpu *tfms;  /* NULL unless compress is set */
+static void *zbuf;
+static unsigned long nr_zpages, zbytes;     /* Compressed chunks and their size, under clipboard_mtx */
+static atomic64_t nr_compress, compress_ns, nr_decompress, decompress_ns;
+
+/*
+ * The chunk array and the per-write page arrays grow to max_pages entries,
+ * too much to ask of kmalloc in one piece: past a page they come from
+ * vmalloc. Free them with kvfree.
+ */
+static void *clipboard_alloc(size_t size, gfp_t flags) {
+  if (size <= PAGE_SIZE)
+    return kmalloc(size, flags);
+  return __vmalloc(size, flags | __GFP_HIGHMEM, PAGE_KERNEL);
+}
+
+static void clipboard_pages_rcu(struct rcu_head *rcu) {
+  kvfree(container_of(rcu, struct clipboard_pages, rcu));
+}
+
+static struct clipboard_pages *clipboard_pages(void) {
+  return rcu_dereference_protected(cb, lockdep_is_held(&clipboard_mtx));
+}
+
+/* Make sure [0, end) is backed by pages. Call with clipboard_mtx held */
+static int clipboard_reserve(size_t end) {
+  struct clipboard_pages *old = clipboard_pages(), *new = old;
+  unsigned int needed = DIV_ROUND_UP(end, PAGE_SIZE);
+
+  if (needed > old->cap) {
+    unsigned int cap = max(old->cap * 2, needed);
+    new = clipboard_alloc(sizeof(struct clipboard_pages) + cap * sizeof(struct clipboard_chunk), GFP_KERNEL);
+    if (!new)
+      return -ENOMEM;
+    new->nr = old->nr;
+    new->cap = cap;
+    memcpy(new->chunk, old->chunk, old->nr * sizeof(struct clipboard_chunk));
+  }
+  /* Pages past the end are invisible to readers: no need for cb_seq */
+  while (new->nr < needed) {
+    new->chunk[new->nr].page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    new->chunk[new->nr].z = NULL;
+    if (!new->chunk[new->nr].page)
+      break;
+    new->nr++;
+  }
+  if (new != old) {
+    rcu_assign_pointer(cb, new);
+    call_rcu(&old->rcu, clipboard_pages_rcu);
+  }
+  return new->nr < needed ? -ENOMEM : 0;
+}
+
+static void clipboard_begin(void) {
+  WRITE_ONCE(shm->seq, shm->seq + 1);  /* Odd: write in progress */
+  smp_wmb();
+}
+
+static void clipboard_end(void) {
+  smp_wmb();
+  WRITE_ONCE(shm->seq, shm->seq + 1);  /* Even again: new contents published */
+  wake_up_interruptible(&clipboard_wq);
+}
+
+static u32 clipboard_generation(void) {
+  return READ_ONCE(shm->seq) / 2;
+}
+
+/* Copy n bytes starting at byte from of a list of pages */
+static void clipboard_copy_from(char *dst, struct page **src, size_t from, size_t n) {
+  size_t chunk;
+
+  while (n) {
+    chunk = min_t(size_t, n, PAGE_SIZE - offset_in_page(from));
+    memcpy(dst, page_address(src[from / PAGE_SIZE]) + offset_in_page(from), chunk);
+    dst += chunk;
+    from += chunk;
+    n -= chunk;
+  }
+}
+
+/* Compress a page, NULL if it does not pay off. Call with clipboard_mtx held */
+static struct clipboard_zpage *clipboard_compress(struct page *page) {
+  unsigned int dlen = ZBUF_SIZE;
+  struct clipboard_zpage *z;
+  u64 start = ktime_get_ns();
+  int err;
+
+  err = crypto_comp_compress(*get_cpu_ptr(tfms), page_address(page), PAGE_SIZE, zbuf, &dlen);
+  put_cpu_ptr(tfms);
+  atomic64_add(ktime_get_ns() - start, &compress_ns);
+  atomic64_inc(&nr_compress);
+
+  if (err || dlen > PAGE_SIZE - PAGE_SIZE / 8)
+    return NULL;
+  z = kmalloc(sizeof(struct clipboard_zpage) + dlen, GFP_KERNEL);
+  if (z) {
+    z->len = dlen;
+    memcpy(z->data, zbuf, dlen);
+  }
+  return z;
+}
+
+static int clipboard_decompress(struct clipboard_zpage *z, char *dst) {
+  unsigned int dlen = PAGE_SIZE;
+  u64 start = ktime_get_ns();
+  int err;
+
+  err = crypto_comp_decompress(*get_cpu_ptr(tfms), z->data, z->len, dst, &dlen);
+  put_cpu_ptr(tfms);
+  atomic64_add(ktime_get_ns() - start, &decompress_ns);
+  atomic64_inc(&nr_decompress);
+  return err ? err : (dlen == PAGE_SIZE ? 0 : -EIO);
+}
+
+/*
+ * Copy bytes [off, off + n) of a chunk to dst + off; a compressed chunk is
+ * uncompressed whole. Readers call it under rcu_read_lock(): swapping a page
+ * for a zpage or the other way round sets the new field before clearing the
+ * old one, so looping finds one of them.
+ */
+static int clipboard_chunk_read(struct clipboard_chunk *c, char *dst, size_t off, size_t n) {
+  struct clipboard_zpage *z;
+  struct page *page;
 
-static struct proc_dir_entry *proc_entry;
-static char *clipboard;  // Space for the "clipboard"
+  for (;;) {
+    page = READ_ONCE(c->page);
+    if (page) {
+      memcpy(dst + off, page_address(page) + off, n);
+      return 0;
+    }
+    smp_rmb();
+    z = READ_ONCE(c->z);
+    if (z)
+      return clipboard_decompress(z, dst);
+  }
+}
+
+/* Publish *new in *c and leave the old contents in *new. Inside a cb_seq write section */
+static void clipboard_chunk_swap(struct clipboard_chunk *c, struct clipboard_chunk *new) {
+  struct clipboard_chunk old = *c;
+
+  if (new->page) {
+    WRITE_ONCE(c->page, new->page);
+    smp_wmb();
+    WRITE_ONCE(c->z, NULL);
+  } else {
+    WRITE_ONCE(c->z, new->z);
+    smp_wmb();
+    WRITE_ONCE(c->page, NULL);
+    nr_zpages++;
+    zbytes += new->z->len;
+  }
+  if (old.z) {
+    nr_zpages--;
+    zbytes -= old.z->len;
+  }
+  *new = old;
+}
+
+/* Release the contents of n chunks, some of which may be empty */
+static void clipboard_put_chunks(struct clipboard_chunk *list, unsigned int n) {
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    if (list[i].page)
+      put_page(list[i].page);
+    kfree(list[i].z);
+  }
+}
+
+/* Free a list of pages, some of which may be NULL */
+static void clipboard_free_pages(struct page **list, unsigned int n) {
+  unsigned int i;
+
+  if (!list)
+    return;
+  for (i = 0; i < n; i++)
+    if (list[i])
+      put_page(list[i]);
+  kvfree(list);
+}
+
+/*
+ * User data first goes to private pages, without any lock held: a fault in
+ * copy_from_user() may even land on a mapping of this clipboard, whose fault
+ * handler takes clipboard_mtx.
+ */
+static ssize_t clipboard_stage(struct page ***stage, const char __user *buf, size_t len) {
+  unsigned int i, nr = DIV_ROUND_UP(len, PAGE_SIZE);
+  size_t done = 0, chunk, left;
+
+  *stage = clipboard_alloc(nr * sizeof(struct page *), GFP_KERNEL | __GFP_ZERO);
+  if (nr && !*stage)
+    return -ENOMEM;
+  for (i = 0; i < nr; i++) {
+    (*stage)[i] = alloc_page(GFP_KERNEL);
+    if (!(*stage)[i])
+      return done ? done : -ENOMEM;
+    chunk = min_t(size_t, len - done, PAGE_SIZE);
+    left = copy_from_user(page_address((*stage)[i]), buf + done, chunk);
+    done += chunk - left;
+    if (left)
+      return done ? done : -EFAULT;
+  }
+  return done;
+}
 
+/*
+ * Writes go to *off (or to the end with O_APPEND), growing the clipboard as
+ * needed. Writing past the end leaves a hole of zeros. Readers see either
+ * all of a write or none of it.
+ */
 static ssize_t clipboard_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
-  int available_space = BUFFER_LENGTH-1;
-  
-  if ((*off) > 0) /* The application can write in this entry just once !! */
+  size_t max_size = (size_t)max_pages * PAGE_SIZE;
+  struct clipboard_chunk *c, *repl = NULL;
+  struct page **stage = NULL;
+  struct clipboard_pages *pg;
+  struct clipboard_zpage *z;
+  unsigned int i, first = 0, nr = 0, nr_repl = 0, nr_stage = DIV_ROUND_UP(len, PAGE_SIZE);
+  size_t base, start, end, old_size, new_size;
+  ssize_t staged;
+  char *dst;
+  loff_t pos;
+  int err = 0;
+
+  if (!len)
     return 0;
-  
-  if (len > available_space) {
+  if (len > max_size) {
     printk(KERN_INFO "clipboard: not enough space!!\n");
     return -ENOSPC;
   }
-  
-  /* Transfer data from user to kernel space */
-  if (copy_from_user( &clipboard[0], buf, len ))  
-    return -EFAULT;
+  staged = clipboard_stage(&stage, buf, len);
+  if (staged < 0) {
+    err = staged;
+    goto free;
+  }
+  len = staged;
+
+  mutex_lock(&clipboard_mtx);
+  pos = (filp->f_flags & O_APPEND) ? size : *off;
+  old_size = size;
+
+  if (pos < 0 || pos > max_size - len) {
+    printk(KERN_INFO "clipboard: not enough space!!\n");
+    err = -ENOSPC;
+    goto out;
+  }
+  if ((err = clipboard_reserve(pos + len)))
+    goto out;
+  pg = clipboard_pages();
+  new_size = max_t(size_t, old_size, pos + len);
+
+  /*
+   * Chunks from the hole (if any) to the end of the write change. Those with
+   * bytes readers can see, and compressed ones, are replaced by new pages;
+   * the rest is written in place.
+   */
+  first = min_t(size_t, old_size, pos) / PAGE_SIZE;
+  /* Growing past one page: the pages written until now are compressed too */
+  if (tfms && old_size <= PAGE_SIZE && new_size > PAGE_SIZE)
+    first = 0;
+  nr = (pos + len - 1) / PAGE_SIZE - first + 1;
+  repl = clipboard_alloc(nr * sizeof(struct clipboard_chunk), GFP_KERNEL | __GFP_ZERO);
+  if (!repl) {
+    err = -ENOMEM;
+    goto out;
+  }
+  for (i = 0; i < nr; i++) {
+    c = &pg->chunk[first + i];
+    base = (size_t)(first + i) * PAGE_SIZE;
+    if (base < old_size || c->z) {
+      repl[i].page = alloc_page(GFP_KERNEL);
+      if (!repl[i].page) {
+        err = -ENOMEM;
+        goto out;
+      }
+      nr_repl++;
+      if (base < old_size && (err = clipboard_chunk_read(c, page_address(repl[i].page), 0, PAGE_SIZE)))
+        goto out;
+    }
+    dst = page_address(repl[i].page ? repl[i].page : c->page);
+
+    /* Pages are reused after a truncation: the hole must not show old data */
+    start = max_t(size_t, base, old_size);
+    end = min_t(size_t, pos, base + PAGE_SIZE);
+    if (start < end)
+      memset(dst + (start - base), 0, end - start);
 
-  clipboard[len] = '\0'; /* Add the `\0' */  
-  *off+=len;            /* Update the file pointer */
+    start = max_t(size_t, base, pos);
+    end = min_t(size_t, pos + len, base + PAGE_SIZE);
+    if (start < end)
+      clipboard_copy_from(dst + (start - base), stage, start - pos, end - start);
+  }
+
+  /* Trade the full pages for compressed copies */
+  for (i = 0; tfms && new_size > PAGE_SIZE && i < nr; i++) {
+    if ((size_t)(first + i + 1) * PAGE_SIZE > new_size)
+      continue;
+    z = clipboard_compress(repl[i].page ? repl[i].page : pg->chunk[first + i].page);
+    if (!z)
+      continue;
+    if (repl[i].page)
+      put_page(repl[i].page);
+    else
+      nr_repl++;
+    repl[i].page = NULL;
+    repl[i].z = z;
+  }
 
-  trace_printk("Current value of clipboard: %s\n", clipboard);
-  
-  return len;
+  clipboard_begin();
+  preempt_disable();
+  write_seqcount_begin(&cb_seq);
+  for (i = 0; i < nr; i++)
+    if (repl[i].page || repl[i].z)
+      clipboard_chunk_swap(&pg->chunk[first + i], &repl[i]);  /* The old contents are freed below */
+  size = new_size;
+  WRITE_ONCE(shm->len, size);
+  write_seqcount_end(&cb_seq);
+  preempt_enable();
+  /* Mappings still point to the old pages: the next access faults in the new ones */
+  if (nr_repl)
+    unmap_mapping_range(filp->f_mapping, (loff_t)(first + 1) << PAGE_SHIFT,
+          (loff_t)nr << PAGE_SHIFT, 1);
+  clipboard_end();
+out:
+  mutex_unlock(&clipboard_mtx);
+
+  if (!err) {
+    *off = pos + len;  /* Update the file pointer */
+    trace_printk("Clipboard: %zu bytes written at %lld, size %zu\n", len, pos, size);
+  }
+  if (!err && nr_repl)
+    synchronize_rcu();  /* Readers may still be copying from the old pages */
+free:
+  if (repl)
+    clipboard_put_chunks(repl, nr);
+  kvfree(repl);
+  clipboard_free_pages(stage, nr_stage);
+  return err ? err : len;
 }
 
+/*
+ * Streaming read from *off: returns whatever fits in the user buffer. Each
+ * page is copied (or uncompressed) to a bounce page under RCU and then to the
+ * user; if a write was published meanwhile the whole read starts over.
+ */
 static ssize_t clipboard_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  
-  int nr_bytes;
-  
-  if ((*off) > 0) /* Tell the application that there is nothing left to read */
-      return 0;
-    
-  nr_bytes=strlen(clipboard);
-    
-  if (len<nr_bytes)
-    return -ENOSPC;
-  
-    /* Transfer data from the kernel to userspace */  
-  if (copy_to_user(buf, clipboard,nr_bytes))
-    return -EINVAL;
-    
-  (*off)+=len;  /* Update the file pointer */
+  struct clipboard_reader *reader = filp->private_data;
+  struct clipboard_pages *pg;
+  size_t done, chunk, at, n, cur_size;
+  loff_t pos = *off;
+  unsigned int seq;
+  char *bounce;
+  int err;
+
+  if (pos < 0)
+    return 0;
+  bounce = (char *)__get_free_page(GFP_KERNEL);
+  if (!bounce)
+    return -ENOMEM;
+
+retry:
+  seq = read_seqcount_begin(&cb_seq);
+  cur_size = READ_ONCE(size);
+  n = (pos < cur_size) ? min_t(size_t, len, cur_size - pos) : 0;
+  smp_rmb();  /* A size is published after the page list that backs it */
+
+  /* Transfer data from the kernel to userspace */
+  for (done = 0; done < n; done += chunk) {
+    at = offset_in_page(pos + done);
+    chunk = min_t(size_t, n - done, PAGE_SIZE - at);
+    rcu_read_lock();
+    pg = rcu_dereference(cb);
+    err = clipboard_chunk_read(&pg->chunk[(pos + done) / PAGE_SIZE], bounce, at, chunk);
+    rcu_read_unlock();
+    if (err && read_seqcount_retry(&cb_seq, seq))
+      goto retry;  /* Torn view of a chunk being replaced */
+    if (err || copy_to_user(buf + done, bounce + at, chunk)) {
+      free_page((unsigned long)bounce);
+      return err ? err : -EFAULT;
+    }
+  }
+  if (read_seqcount_retry(&cb_seq, seq))
+    goto retry;
+  free_page((unsigned long)bounce);
+  WRITE_ONCE(reader->seen, seq / 2);  /* cb_seq and shm->seq move together */
+
+  (*off)+=n;  /* Update the file pointer */
+
+  return n;
+}
+
+/* `echo x > /proc/clipboard` opens with O_TRUNC: start over, as before */
+static int clipboard_open(struct inode *inode, struct file *filp) {
+  struct clipboard_reader *reader = kmalloc(sizeof(struct clipboard_reader), GFP_KERNEL);
+
+  if (!reader)
+    return -ENOMEM;
+  filp->private_data = reader;
+
+  if ((filp->f_mode & FMODE_WRITE) && (filp->f_flags & O_TRUNC)) {
+    mutex_lock(&clipboard_mtx);
+    clipboard_begin();
+    preempt_disable();
+    write_seqcount_begin(&cb_seq);
+    size = 0;
+    WRITE_ONCE(shm->len, 0);
+    write_seqcount_end(&cb_seq);
+    preempt_enable();
+    clipboard_end();
+    mutex_unlock(&clipboard_mtx);
+  }
+  reader->seen = clipboard_generation();
+  return 0;
+}
+
+static int clipboard_release(struct inode *inode, struct file *filp) {
+  kfree(filp->private_data);
+  return 0;
+}
 
-  return nr_bytes; 
+static unsigned int clipboard_poll(struct file *filp, poll_table *wait) {
+  struct clipboard_reader *reader = filp->private_data;
+
+  poll_wait(filp, &clipboard_wq, wait);
+  if (clipboard_generation() != READ_ONCE(reader->seen))
+    return POLLIN | POLLRDNORM;
+  return 0;
+}
+
+static long clipboard_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+  struct clipboard_reader *reader = filp->private_data;
+  struct clipboard_gen gen;
+
+  if (cmd != CLIPBOARD_IOC_GENERATION)
+    return -ENOTTY;
+  gen.seen = READ_ONCE(reader->seen);
+  gen.latest = clipboard_generation();
+  if (copy_to_user((void __user *)arg, &gen, sizeof(gen)))
+    return -EFAULT;
+  return 0;
+}
+
+static loff_t clipboard_llseek(struct file *filp, loff_t offset, int whence) {
+  return generic_file_llseek_size(filp, offset, whence,
+        (loff_t)max_pages * PAGE_SIZE, READ_ONCE(size));
+}
+
+/*
+ * Page 0 of a mapping is the header, page i the (i-1)-th page of the clipboard.
+ * clipboard_mtx keeps a fault from installing a page a writer is replacing.
+ * Compressed pages have no page to map: touching them raises SIGBUS.
+ */
+static int clipboard_fault(struct vm_area_struct *vma, struct vm_fault *vmf) {
+  struct clipboard_pages *pg;
+  struct page *page = NULL;
+
+  mutex_lock(&clipboard_mtx);
+  pg = clipboard_pages();
+  if (vmf->pgoff == 0)
+    page = header;
+  else if (vmf->pgoff - 1 < pg->nr)
+    page = pg->chunk[vmf->pgoff - 1].page;
+  if (page)
+    get_page(page);
+  mutex_unlock(&clipboard_mtx);
+
+  if (!page)
+    return VM_FAULT_SIGBUS;
+  vmf->page = page;
+  return 0;
+}
+
+static const struct vm_operations_struct clipboard_vm_ops = {
+    .fault = clipboard_fault,
+};
+
+/* Read-only mapping of the header and data pages (see clipboard_mmap.h) */
+static int clipboard_mmap(struct file *filp, struct vm_area_struct *vma) {
+  if (vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  vma->vm_flags &= ~VM_MAYWRITE;
+  vma->vm_ops = &clipboard_vm_ops;
+  return 0;
 }
 
 static const struct file_operations proc_entry_fops = {
+    .open = clipboard_open,
     .read = clipboard_read,
-    .write = clipboard_write,    
+    .write = clipboard_write,
+    .llseek = clipboard_llseek,
+    .mmap = clipboard_mmap,
+    .poll = clipboard_poll,
+    .unlocked_ioctl = clipboard_ioctl,
+    .release = clipboard_release,
 };
 
+/* /proc/clipboard_stats: what compression saves, and what it costs */
+static int clipboard_stats_show(struct seq_file *m, void *v) {
+  unsigned long nr_pages, zpages, bytes;
+  u64 nc = atomic64_read(&nr_compress), nd = atomic64_read(&nr_decompress);
+
+  mutex_lock(&clipboard_mtx);
+  nr_pages = clipboard_pages()->nr;
+  zpages = nr_zpages;
+  bytes = zbytes;
+  mutex_unlock(&clipboard_mtx);
+
+  seq_printf(m, "compress: %s\n", tfms ? compress : "none");
+  seq_printf(m, "size: %zu bytes\n", READ_ONCE(size));
+  seq_printf(m, "pages: %lu (%lu compressed)\n", nr_pages, zpages);
+  seq_printf(m, "memory: %lu bytes\n", (nr_pages - zpages) * PAGE_SIZE + bytes);
+  if (bytes)
+    seq_printf(m, "ratio: %lu.%02lu\n", zpages * PAGE_SIZE / bytes,
+          zpages * PAGE_SIZE * 100 / bytes % 100);
+  seq_printf(m, "compress: %llu pages, %llu ns (%llu ns/page)\n", nc,
+        atomic64_read(&compress_ns), nc ? atomic64_read(&compress_ns) / nc : 0);
+  seq_printf(m, "decompress: %llu pages, %llu ns (%llu ns/page)\n", nd,
+        atomic64_read(&decompress_ns), nd ? atomic64_read(&decompress_ns) / nd : 0);
+  return 0;
+}
+
+static int clipboard_stats_open(struct inode *inode, struct file *filp) {
+  return single_open(filp, clipboard_stats_show, NULL);
+}
+
+static const struct file_operations stats_entry_fops = {
+    .open = clipboard_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static void clipboard_exit_compression(void) {
+  int cpu;
+
+  if (tfms)
+    for_each_possible_cpu(cpu)
+      if (*per_cpu_ptr(tfms, cpu))
+        crypto_free_comp(*per_cpu_ptr(tfms, cpu));
+  free_percpu(tfms);
+  tfms = NULL;
+  kfree(zbuf);
+}
+
+static int clipboard_init_compression(void) {
+  struct crypto_comp *tfm;
+  int cpu;
+
+  if (!*compress)
+    return 0;
+  if (!crypto_has_comp(compress, 0, 0)) {
+    printk(KERN_INFO "Clipboard: unknown compression algorithm %s\n", compress);
+    return -EINVAL;
+  }
+  tfms = alloc_percpu(struct crypto_comp *);
+  zbuf = kmalloc(ZBUF_SIZE, GFP_KERNEL);
+  if (!tfms || !zbuf)
+    goto nomem;
+  for_each_possible_cpu(cpu) {
+    tfm = crypto_alloc_comp(compress, 0, 0);
+    if (IS_ERR(tfm))
+      goto nomem;
+    *per_cpu_ptr(tfms, cpu) = tfm;
+  }
+  return 0;
+nomem:
+  clipboard_exit_compression();
+  return -ENOMEM;
+}
+
 
 
 int init_clipboard_module( void )
 {
-  int ret = 0;
-  clipboard = (char *)vmalloc( BUFFER_LENGTH );
+  int ret = clipboard_init_compression();
 
-  if (!clipboard) {
+  if (ret)
+    return ret;
+  header = alloc_page( GFP_KERNEL | __GFP_ZERO );
+  RCU_INIT_POINTER(cb, kzalloc(sizeof(struct clipboard_pages), GFP_KERNEL));
+  seqcount_init(&cb_seq);
+
+  if (!header || !rcu_access_pointer(cb)) {
     ret = -ENOMEM;
+    if (header)
+      __free_page(header);
+    kfree(rcu_access_pointer(cb));
   } else {
 
-    memset( clipboard, 0, BUFFER_LENGTH );
+    shm = page_address(header);
     proc_entry = proc_create( "clipboard", 0666, NULL, &proc_entry_fops);
-    if (proc_entry == NULL) {
+    stats_entry = proc_create( "clipboard_stats", 0444, NULL, &stats_entry_fops);
+    if (proc_entry == NULL || stats_entry == NULL) {
       ret = -ENOMEM;
-      vfree(clipboard);
+      if (proc_entry)
+        remove_proc_entry("clipboard", NULL);
+      if (stats_entry)
+        remove_proc_entry("clipboard_stats", NULL);
+      __free_page(header);
+      kfree(rcu_access_pointer(cb));
       printk(KERN_INFO "Clipboard: Can't create /proc entry\n");
     } else {
       printk(KERN_INFO "Clipboard: Module loaded\n");
     }
   }
+  if (ret)
+    clipboard_exit_compression();
 
   return ret;
 
@@ -94,8 +714,15 @@ int init_clipboard_module( void )
 
 void exit_clipboard_module( void )
 {
+  struct clipboard_pages *pg = rcu_dereference_protected(cb, 1);
+
+  remove_proc_entry("clipboard_stats", NULL);
   remove_proc_entry("clipboard", NULL);
-  vfree(clipboard);
+  clipboard_put_chunks(pg->chunk, pg->nr);
+  kvfree(pg);
+  rcu_barrier();  /* Pending clipboard_pages_rcu callbacks run module code */
+  put_page(header);
+  clipboard_exit_compression();
   printk(KERN_INFO "Clipboard: Module unloaded.\n");
 }
 
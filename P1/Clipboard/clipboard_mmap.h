@@ -0,0 +1,44 @@
+#ifndef CLIPBOARD_MMAP_H
+#define CLIPBOARD_MMAP_H
+
+/*
+ * Layout of an mmap() of /proc/clipboard (read-only, MAP_SHARED). Shared by
+ * the module and user programs.
+ *
+ *   page 0:  struct clipboard_shm
+ *   page 1-: clipboard contents, clipboard_shm.len bytes
+ *
+ * Data pages are mapped on demand, so a reader can map a window as large as
+ * the max_pages module parameter allows. Touching a page the clipboard has
+ * never reached raises SIGBUS. Bytes past len are stale, not zeros.
+ * When the module is loaded with compress=, full pages of a clipboard
+ * larger than one page are stored compressed and raise SIGBUS as well:
+ * the header still works, but the contents must be read() (or pread()).
+ *
+ * seq is odd while a write is in progress. To take a consistent snapshot,
+ * read seq (retry while odd), copy len bytes from the data pages, and retry
+ * if seq changed meanwhile. Comparing seq with a previous value tells
+ * whether the clipboard changed, without any system call.
+ *
+ * Readers that would rather sleep can poll()/epoll the file descriptor
+ * instead: it becomes readable when a write lands after its last read().
+ * CLIPBOARD_IOC_GENERATION then tells whether writes were missed in
+ * between (latest - seen > 1 after the wakeup, before reading again).
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+struct clipboard_shm {
+  __u32 seq;   /* incremented twice by every write */
+  __u32 len;   /* bytes in the data pages */
+};
+
+struct clipboard_gen {
+  __u32 seen;    /* generation returned by this descriptor's last read() */
+  __u32 latest;  /* current generation (seq / 2) */
+};
+
+#define CLIPBOARD_IOC_GENERATION  _IOR('c', 1, struct clipboard_gen)
+
+#endif
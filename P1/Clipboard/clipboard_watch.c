@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "clipboard_mmap.h"
+
+/*
+ * Watches /proc/clipboard through a read-only mapping: it checks the
+ * sequence counter every interval and prints the contents when they change,
+ * without read() calls or copies in the kernel.
+ * Build with: gcc -Wall -o clipboard_watch clipboard_watch.c
+ *  ./clipboard_watch [interval in ms] [file]
+ * The file defaults to /proc/clipboard; /proc/test/clipboard (6P6) has the
+ * same layout, limited to one data page. If the module compresses its pages
+ * (compress= parameter) the contents are read with pread() instead.
+ */
+
+/* Data pages to map: the max_pages parameter of the module, if loaded */
+static long window_pages(void){
+	FILE *f = fopen("/sys/module/clipboard/parameters/max_pages", "r");
+	long n = 1;
+
+	if (f){
+		if (fscanf(f, "%ld", &n) != 1)
+			n = 1;
+		fclose(f);
+	}
+	return n;
+}
+
+/* Whether the module was loaded with compress=, so data pages can't be mapped */
+static int compressed(void){
+	FILE *f = fopen("/sys/module/clipboard/parameters/compress", "r");
+	int c = EOF;
+
+	if (f){
+		c = fgetc(f);
+		fclose(f);
+	}
+	return c != EOF && c != '\n';
+}
+
+int main(int argc, char *argv[]){
+	long page = sysconf(_SC_PAGESIZE);
+	int interval = argc > 1 ? atoi(argv[1]) : 100;
+	const char *file = argc > 2 ? argv[2] : "/proc/clipboard";
+	volatile struct clipboard_shm *shm;
+	long npages = window_pages();
+	int use_read = compressed() && strcmp(file, "/proc/clipboard") == 0;
+	const char *data;
+	char *copy;
+	unsigned int seq, last = 0, len;
+	void *map;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0){
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+	map = mmap(NULL, (npages + 1) * page, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED){
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	if (!use_read)
+		close(fd);
+	shm = map;
+	data = (const char *)map + page;
+	copy = malloc(npages * page + 1);
+	if (!copy){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	while (1){
+		seq = shm->seq;
+		if (seq != last && !(seq & 1)){
+			len = shm->len;
+			if (len > npages * page)
+				len = npages * page;
+			__sync_synchronize();
+			if (!use_read)
+				memcpy(copy, data, len);
+			else if (pread(fd, copy, len, 0) != len)
+				len = 0;
+			__sync_synchronize();
+			if (shm->seq == seq){	/* nobody wrote while we copied */
+				copy[len] = '\0';
+				printf("[%u] %s", seq / 2, copy);
+				if (len && copy[len - 1] != '\n')
+					printf("\n");
+				fflush(stdout);
+				last = seq;
+				continue;
+			}
+		}
+		usleep(interval * 1000);
+	}
+	return 0;
+}
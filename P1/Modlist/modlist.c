@@ -6,13 +6,12 @@
 #include <linux/uaccess.h>
 #include <linux/ftrace.h>
 #include <linux/list.h>
+#include <linux/seq_file.h>
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Modlist Kernel Module - FDI-UCM");
 MODULE_AUTHOR("Xukai Chen, Daniel Alfaro");
 
-#define MAX_SIZE      		12
-#define TEMP_BUFFER_LENGTH  4
 #define COMMANDS_LENGTH		100	
 
 static struct proc_dir_entry *proc_entry;
@@ -25,13 +24,23 @@ struct list_head mylist; // nodo fantasma
 
 struct list_item {
 	int data;
+	int cursor;		// 1 si es el marcador de un lector, no un dato
 	struct list_head links;
 };
 
+/* Estado de lectura de cada apertura de /proc/modlist */
+struct modlist_iter {
+	struct list_item cursor;	// marcador que se deja en mylist en cada stop()
+	loff_t cursor_pos;			// posicion del elemento que sigue al marcador
+	loff_t pos;					// posicion del ultimo elemento devuelto por start/next
+};
+
 void modlist_cleanup ( void ){
 	/* cleanup de la lista */
 	struct list_item *it, *item = NULL;
 	list_for_each_entry_safe(item, it, &mylist, links){ // esto recorre las entradas de la lista
+		if (item->cursor) // los marcadores pertenecen a los lectores
+			continue;
 		list_del(&(item->links));
 		vfree(item);
 	}
@@ -68,12 +77,13 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 		if (!item)
 			return -ENOMEM;
 		item->data = num;
+		item->cursor = 0;
 		list_add_tail(&(item->links), &mylist);
 	}
 	else if(sscanf(command_buf, "remove %d", &num) == 1){
 		struct list_item *it = NULL;
 		list_for_each_entry_safe(item, it, &mylist, links){
-			if(item->data == num){
+			if(!item->cursor && item->data == num){
 				list_del(&(item->links));
 				vfree(item);
 			}
@@ -88,66 +98,98 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 	return len;
 }
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  
-	int nr_bytes, total_bytes = 0, wt_bytes = 0, to_wt = 0;			// nr_bytes: aux, total_bytes: return value, wt_bytes: bytes to write, to_wt: max bytes can write on buffer 
-	struct list_item *it, *item = NULL; 							// iterator and temp value
-	char rd_buf[TEMP_BUFFER_LENGTH];								// temp buffer
-	char data_buf[MAX_SIZE];										// aux buffer, number to char 
-	char *ptr_rdbuf = rd_buf, *ptr_buf = buf, *ptr_data = data_buf; // as names indicate
-	
-	if ((*off) > 0) /* Tell the application that there is nothing left to read */
-		return 0;
-	/*
-	trace_printk("Debugging --> len's value: %lu.\n", len);
-	trace_printk("Debugging --> off's value: %lu.\n", (*off));
-	*/
-
-	list_for_each_entry_safe(item, it, &mylist, links){
-		/*
-		trace_printk("Debugging --> Current length of read buffer: %ld.\n", (ptr_rdbuf - rd_buf));
-		trace_printk("Debugging --> Current remaining buffer: %lu.\n", (TEMP_BUFFER_LENGTH - (ptr_rdbuf - rd_buf)));
-		trace_printk("Debugging --> Current length written: %d.\n", sprintf(data_buf, "%d\n", item->data));
-		*/
-		
-		nr_bytes = ptr_rdbuf - rd_buf;
-		to_wt = TEMP_BUFFER_LENGTH - nr_bytes;
-		
-		if ( to_wt < sprintf(ptr_data, "%d\n", item->data)){
-			trace_printk("Modlist: Looping on buffer: %d out %d.\n", nr_bytes, TEMP_BUFFER_LENGTH);
-			do {
-				wt_bytes = snprintf(ptr_rdbuf, to_wt, ptr_data);
-				if (copy_to_user(ptr_buf, rd_buf, TEMP_BUFFER_LENGTH))
-					return -EINVAL;
-				ptr_buf += TEMP_BUFFER_LENGTH - 1;		
-				ptr_rdbuf = rd_buf;
-				ptr_data += to_wt - 1;
-				total_bytes += TEMP_BUFFER_LENGTH - 1;
-				wt_bytes -= to_wt - 1;
-				to_wt = TEMP_BUFFER_LENGTH;
-			}while (TEMP_BUFFER_LENGTH <= wt_bytes);
-		}
-		ptr_rdbuf += sprintf(ptr_rdbuf, ptr_data);
-		ptr_data = data_buf;
+/*
+ * Lectura con seq_file: cada llamada a read() formatea como mucho una pagina.
+ * Al parar se deja un marcador en la lista delante del siguiente elemento, asi
+ * la siguiente lectura continua en O(1) aunque se hayan borrado elementos
+ * mientras tanto.
+ */
+
+/* Siguiente dato despues de node, saltando los marcadores de los lectores */
+static struct list_item *modlist_next_item(struct list_head *node){
+	struct list_item *item = NULL;
+	for (node = node->next; node != &mylist; node = node->next){
+		item = list_entry(node, struct list_item, links);
+		if (!item->cursor)
+			return item;
 	}
-	total_bytes += ptr_rdbuf - rd_buf;
-		
-	if (len<total_bytes)
-		return -ENOSPC;
+	return NULL;
+}
 
-	/* Transfer data from the kernel to userspace */  
-	if (copy_to_user(ptr_buf, rd_buf, (ptr_rdbuf - rd_buf)))
-		return -EINVAL;
+static void *modlist_start(struct seq_file *f, loff_t *pos){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = NULL;
+	loff_t i;
+
+	iter->pos = *pos;
+
+	if (*pos && *pos == iter->cursor_pos) /* continuar donde paro la lectura anterior */
+		return modlist_next_item(&(iter->cursor.links));
+
+	/* primera lectura o lseek: recorrido desde el principio */
+	item = modlist_next_item(&mylist);
+	for (i = 0; item && i < *pos; i++)
+		item = modlist_next_item(&(item->links));
+	return item;
+}
+
+static void *modlist_next(struct seq_file *f, void *v, loff_t *pos){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = v;
+
+	(*pos)++;
+	iter->pos = *pos;
+	return modlist_next_item(&(item->links));
+}
 
-	(*off)+=total_bytes;  /* Update the file pointer */
+static void modlist_stop(struct seq_file *f, void *v){
+	struct modlist_iter *iter = f->private;
+	struct list_item *item = v;
 
-	return total_bytes; 
+	/* v es el primer elemento sin mostrar (NULL si se llego al final) */
+	if (item)
+		list_move_tail(&(iter->cursor.links), &(item->links));
+	else
+		list_move_tail(&(iter->cursor.links), &mylist);
+	iter->cursor_pos = iter->pos;
 }
 
+static int modlist_show(struct seq_file *f, void *v){
+	struct list_item *item = v;
+	seq_printf(f, "%d\n", item->data);
+	return 0;
+}
+
+static const struct seq_operations modlist_op = {
+	.start = modlist_start,
+	.next = modlist_next,
+	.stop = modlist_stop,
+	.show = modlist_show
+};
+
+static int modlist_open(struct inode *inode, struct file *file){
+	struct modlist_iter *iter = __seq_open_private(file, &modlist_op, sizeof(struct modlist_iter));
+	if (!iter)
+		return -ENOMEM;
+	iter->cursor.cursor = 1;
+	INIT_LIST_HEAD(&(iter->cursor.links));
+	iter->cursor_pos = -1;
+	return 0;
+}
+
+static int modlist_release(struct inode *inode, struct file *file){
+	struct modlist_iter *iter = ((struct seq_file *)file->private_data)->private;
+
+	list_del(&(iter->cursor.links));
+	return seq_release_private(inode, file);
+}
 
 static const struct file_operations proc_entry_fops = {
-    .read = modlist_read,
-    .write = modlist_write,    
+    .open = modlist_open,
+    .read = seq_read,
+    .write = modlist_write,
+    .llseek = seq_lseek,
+    .release = modlist_release
 };
 
 int init_modlist_module( void )
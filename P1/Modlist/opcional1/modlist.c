@@ -6,6 +6,8 @@
 #include <linux/uaccess.h>
 #include <linux/ftrace.h>
 #include <linux/list.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Modlist Kernel Module - FDI-UCM");
@@ -14,6 +16,7 @@ MODULE_AUTHOR("Xukai Chen, Daniel Alfaro");
 #define MAX_SIZE      		12
 #define TEMP_BUFFER_LENGTH  4
 #define COMMANDS_LENGTH		100	
+#define HASH_BITS_MODLIST	16		// 64K cubetas para el indice de remove
 
 static struct proc_dir_entry *proc_entry;
 /*
@@ -23,17 +26,24 @@ static char* data_buf;
 */
 struct list_head mylist; // nodo fantasma
 
+/* Indice hash por valor: remove solo recorre los elementos de su cubeta */
+static DEFINE_HASHTABLE(modlist_hash, HASH_BITS_MODLIST);
+
 #ifdef PARTE_OPCIONAL
 
 struct list_item {
 	char data[MAX_SIZE];
-	struct list_head links;
+	struct list_head links;	// orden de insercion (lo que se ve en cat)
+	struct hlist_node hash;	// indice por valor para remove
 };
 
+#define modlist_key(str)	jhash((str), strlen(str), 0)
+
 void modlist_cleanup ( void ){
 	/* cleanup de la lista */
 	struct list_item *it, *item = NULL;
 	list_for_each_entry_safe(item, it, &mylist, links){ // esto recorre las entradas de la lista
+		hash_del(&(item->hash));
 		list_del(&(item->links));
 		vfree(item);
 	}
@@ -75,15 +85,17 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 			return -ENOMEM;
 		strcpy(item->data, temp);
 		list_add_tail(&(item->links), &mylist);
+		hash_add(modlist_hash, &(item->hash), modlist_key(item->data));
 	}
 	else if(sscanf(command_buf, "remove %s", temp) == 1){
-		struct list_item *it = NULL;
+		struct hlist_node *tmp = NULL;
 		if(strlen(temp) > MAX_SIZE){
 			printk(KERN_INFO "modlist: data size too large!! %d expected\n", MAX_SIZE);
 			return -ENOSPC;
 		} 
-		list_for_each_entry_safe(item, it, &mylist, links){
+		hash_for_each_possible_safe(modlist_hash, item, tmp, hash, modlist_key(temp)){
 			if(strcmp(item->data, temp) == 0){
+				hash_del(&(item->hash));
 				list_del(&(item->links));
 				vfree(item);
 			}
@@ -159,13 +171,17 @@ static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, lof
 
 struct list_item {
 	int data;
-	struct list_head links;
+	struct list_head links;	// orden de insercion (lo que se ve en cat)
+	struct hlist_node hash;	// indice por valor para remove
 };
 
+#define modlist_key(num)	(num)
+
 void modlist_cleanup ( void ){
 	/* cleanup de la lista */
 	struct list_item *it, *item = NULL;
 	list_for_each_entry_safe(item, it, &mylist, links){ // esto recorre las entradas de la lista
+		hash_del(&(item->hash));
 		list_del(&(item->links));
 		vfree(item);
 	}
@@ -203,11 +219,13 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
 			return -ENOMEM;
 		item->data = num;
 		list_add_tail(&(item->links), &mylist);
+		hash_add(modlist_hash, &(item->hash), modlist_key(num));
 	}
 	else if(sscanf(command_buf, "remove %d", &num) == 1){
-		struct list_item *it = NULL;
-		list_for_each_entry_safe(item, it, &mylist, links){
+		struct hlist_node *tmp = NULL;
+		hash_for_each_possible_safe(modlist_hash, item, tmp, hash, modlist_key(num)){
 			if(item->data == num){
+				hash_del(&(item->hash));
 				list_del(&(item->links));
 				vfree(item);
 			}